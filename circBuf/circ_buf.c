@@ -1,64 +1,757 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/cdev.h>
+#include <linux/device.h>
 #include <linux/slab.h>
 #include <linux/circ_buf.h>
 #include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/irq_work.h>
+#include <linux/export.h>
+
+#include "circ_buf_uapi.h"
+#include "circ_buf_kernel.h"
 
-#define BUF_SIZE 128  // 環形緩衝區大小
 #define DEVICE_NAME "circ_buf"
+#define RING_SIZE_MAX (256U << 20)  // ring 大小上限 256MB
+#define CIRC_BUF_MAX_DEVS 64        // minor 數量上限
+
+// 環形緩衝區：head/tail 放在可以 mmap 給 user space 的共享控制頁裡
+struct circ_ring {
+    struct circ_buf_ctrl *ctrl;   // 共享控制頁 (head/tail)
+    char *data;                   // 資料區
+    unsigned int size;            // 資料區大小，kernel 自己保留一份，不信任 ctrl->size
+    void *area;                   // vmalloc_user()：控制頁 + 資料頁，整塊可以 mmap
+    struct mutex prod_lock;       // 同一個 ring 的 writer 之間排隊
+    unsigned long ow_seq;         // overwrite 模式下 producer 搬動 tail 的次數，只有 producer 寫
+} ____cacheline_aligned_in_smp;
+
+// 單一 producer / 單一 consumer (SPSC)：
+// producer 只寫 head，consumer 只寫 tail，兩邊靠 acquire/release 同步，彼此不需要鎖。
+// overwrite 模式例外：ring 滿了 producer 也會往前搬 tail，這時兩邊都用 cmpxchg 更新 tail，
+// consumer 複製完還要用 ow_seq 確認資料沒有在複製期間被蓋掉，見 circ_buf_make_room()。
+// 同一個 ring 的 writer 之間用 ring->prod_lock 排隊，同一個設備的 reader 之間用 cons_lock 排隊，
+// 所以任何時刻每個 ring 上最多只有一個 producer 和一個 consumer。
+//
+// percpu=1 時每顆 possible CPU 各有一個 ring，writer 只寫自己 CPU 的 ring，
+// prod_lock 只會被同一顆 CPU 上的 writer (或剛被搬走的 writer) 搶到，沒有跨 CPU 的 cache line 來回；
+// reader 輪流把所有 ring 倒出來。percpu=0 時只用 rings[0]。
+//
+// kernel 內部的 producer (circ_buf_log()) 另外寫進每顆 CPU 一個的 krings，
+// 關中斷就能保證同一個 kring 同時只有一個 producer；reader 把 rings 和 krings 一起倒出來。
+//
+// 每個 minor (/dev/circ_buf0 .. N-1) 是一個獨立的 circ_dev，彼此不共用任何鎖或 ring。
+struct circ_dev {
+    struct circ_ring *rings;
+    unsigned int nr_rings;
+    struct circ_ring *krings;     // kring_size=0 時為 NULL
+    unsigned int nr_krings;
+    unsigned int next_ring;       // reader 下一次從哪個 ring 開始 (受 cons_lock 保護)
+    struct mutex cons_lock;
+
+    wait_queue_head_t read_wq;    // reader 等資料
+    wait_queue_head_t write_wq;   // writer 等空間
+
+    // 被 reject 丟掉的 bytes、被 overwrite 蓋掉的 bytes，透過 debugfs circ_buf/circ_bufN/stats 讀取
+    atomic64_t stat_dropped;
+    atomic64_t stat_overwritten;
+
+    struct cdev cdev;
+    unsigned int minor;
+};
+
+static struct circ_dev *devs;
+static unsigned int nr_registered;   // 已經 cdev_add + device_create 的數量
+static dev_t dev_base;
+static struct class *circ_buf_class;
+static struct dentry *debugfs_dir;
+
+static unsigned int nr_devs = 1;
+module_param(nr_devs, uint, 0444);
+MODULE_PARM_DESC(nr_devs, "Number of independent ring devices /dev/circ_buf0..N-1 (default 1, max 64)");
+
+static unsigned int ring_size = 65536;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Ring size in bytes (power of two, up to 256MB, default 64KB)");
+
+static unsigned int kring_size = 16384;
+module_param(kring_size, uint, 0444);
+MODULE_PARM_DESC(kring_size, "Per-CPU ring size for in-kernel producers (power of two, 0 = disable circ_buf_log())");
+
+static bool percpu;
+module_param(percpu, bool, 0444);
+MODULE_PARM_DESC(percpu, "Use one ring per CPU; writers append to the local ring and readers drain all of them");
+
+static bool msg_mode;
+module_param(msg_mode, bool, 0444);
+MODULE_PARM_DESC(msg_mode, "Store each write (or each writev segment) as a record; reads return whole records");
+
+// ring 滿了的時候怎麼辦：block = 等 reader、reject = 回傳 -ENOSPC、
+// overwrite = 丟掉最舊的資料 (flight recorder，producer 永遠不會被擋住)
+enum circ_buf_overflow {
+    OVERFLOW_BLOCK,
+    OVERFLOW_REJECT,
+    OVERFLOW_OVERWRITE,
+};
+
+static const char * const overflow_names[] = {
+    [OVERFLOW_BLOCK] = "block",
+    [OVERFLOW_REJECT] = "reject",
+    [OVERFLOW_OVERWRITE] = "overwrite",
+};
+
+static char *overflow = "block";
+module_param(overflow, charp, 0444);
+MODULE_PARM_DESC(overflow, "Policy when the ring is full: block, reject or overwrite (oldest data)");
+
+static int overflow_policy;   // init 時由 overflow 字串解析
+
+static unsigned long selftest_bytes;
+module_param(selftest_bytes, ulong, 0444);
+MODULE_PARM_DESC(selftest_bytes, "Bytes moved by the SPSC selftest at load time (0 = disabled)");
 
-static struct circ_buf my_circ_buf;
-static dev_t dev_num;
-static struct cdev my_cdev;
+// **目前可讀的 bytes / 可寫的空間 (給 wait/poll 判斷用，不需要鎖)**
+static unsigned int circ_ring_count(struct circ_ring *r)
+{
+    unsigned int mask = r->size - 1;
+
+    return CIRC_CNT(smp_load_acquire(&r->ctrl->head) & mask,
+                    READ_ONCE(r->ctrl->tail) & mask, r->size);
+}
 
-// **寫入函式：支援 `echo "data" > /dev/circ_buf`**
-static ssize_t circ_buf_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+static unsigned int circ_ring_space(struct circ_ring *r)
 {
-    int free_space = CIRC_SPACE(my_circ_buf.head, my_circ_buf.tail, BUF_SIZE);
-    char kbuf[BUF_SIZE];
-    int i;
+    unsigned int mask = r->size - 1;
 
-    if (count > free_space)
-        return -ENOSPC;  // 空間不足
+    return CIRC_SPACE(READ_ONCE(r->ctrl->head) & mask,
+                      smp_load_acquire(&r->ctrl->tail) & mask, r->size);
+}
 
-    if (copy_from_user(kbuf, buf, count))
-        return -EFAULT;
+// **叫醒等待的一方；wq_has_sleeper() 內含 barrier，沒人在等時不碰 waitqueue 的鎖**
+static void circ_buf_wake(struct wait_queue_head *wq)
+{
+    if (wq_has_sleeper(wq))
+        wake_up_interruptible(wq);
+}
+
+// **writer 使用的 ring：percpu 模式下是目前 CPU 的 ring**
+static struct circ_ring *circ_buf_local_ring(struct circ_dev *cd)
+{
+    return cd->nr_rings > 1 ? &cd->rings[raw_smp_processor_id()] : &cd->rings[0];
+}
 
-    for (i = 0; i < count; i++) {
-        my_circ_buf.buf[my_circ_buf.head] = kbuf[i];
-        my_circ_buf.head = (my_circ_buf.head + 1) & (BUF_SIZE - 1);
+// **reader 看到的第 i 個 ring：先是 user space writer 的 rings，接著是 kernel producer 的 krings**
+static struct circ_ring *circ_dev_ring(struct circ_dev *cd, unsigned int i)
+{
+    return i < cd->nr_rings ? &cd->rings[i] : &cd->krings[i - cd->nr_rings];
+}
+
+static unsigned int circ_dev_nr_all(struct circ_dev *cd)
+{
+    return cd->nr_rings + cd->nr_krings;
+}
+
+// **所有 ring 加起來可讀的 bytes**
+static unsigned int circ_buf_count_all(struct circ_dev *cd)
+{
+    struct circ_ring *r;
+    unsigned int i, cnt = 0;
+
+    for (i = 0; i < circ_dev_nr_all(cd); i++) {
+        r = circ_dev_ring(cd, i);
+        if (r->area)
+            cnt += circ_ring_count(r);
     }
-    return count;
+    return cnt;
+}
+
+// **從 ring 的 pos 位置讀出 len bytes 到 kernel buffer (可能繞回開頭)，不移動 tail**
+static void circ_ring_read_at(struct circ_ring *r, unsigned int pos, void *dst, unsigned int len)
+{
+    unsigned int first = min(len, r->size - pos);
+
+    memcpy(dst, r->data + pos, first);
+    memcpy((char *)dst + first, r->data, len - first);
 }
 
-// **讀取函式：支援 `cat /dev/circ_buf`**
-static ssize_t circ_buf_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+// **consumer 開始讀之前記下 ow_seq；讀完用 circ_ring_read_retry() 檢查**
+static unsigned long circ_ring_read_begin(struct circ_ring *r)
 {
-    int available = CIRC_CNT(my_circ_buf.head, my_circ_buf.tail, BUF_SIZE);
-    char kbuf[BUF_SIZE];
-    int i;
+    unsigned long seq = READ_ONCE(r->ow_seq);
 
-    if (count > available)
-        count = available;
+    smp_rmb();   // 先讀 ow_seq 再讀 tail 和資料
+    return seq;
+}
 
-    if (count == 0)
-        return 0; // 沒有可讀取的數據
+// **讀的期間有 producer 丟過資料 (剛讀到的可能已經被蓋掉) 回傳 true**
+static bool circ_ring_read_retry(struct circ_ring *r, unsigned long seq)
+{
+    smp_rmb();   // 資料讀完才檢查 ow_seq
+    return READ_ONCE(r->ow_seq) != seq;
+}
 
-    for (i = 0; i < count; i++) {
-        kbuf[i] = my_circ_buf.buf[my_circ_buf.tail];
-        my_circ_buf.tail = (my_circ_buf.tail + 1) & (BUF_SIZE - 1);
+// **consumer 歸還空間：old 是讀之前的 tail (未 mask)，成功回傳 true**
+// overwrite 模式下 producer 可能同時搬動 tail，用 cmpxchg；回傳 false 代表這次讀到的資料不能用，要重讀
+static bool circ_ring_commit_tail(struct circ_ring *r, unsigned long seq, unsigned int old,
+                                  unsigned int new)
+{
+    if (overflow_policy != OVERFLOW_OVERWRITE) {
+        smp_store_release(&r->ctrl->tail, new);
+        return true;
     }
+    if (circ_ring_read_retry(r, seq))
+        return false;
+    return cmpxchg_release(&r->ctrl->tail, old, new) == old;
+}
+
+// **Producer：放入 len bytes，空間不足時回傳 -ENOSPC**
+// (呼叫者需持有 prod_lock；kring 則是關中斷後由目前 CPU 獨佔)
+// head/tail 可能被 mmap 的 user space 改掉，讀出來一律先 mask，避免越界
+static int circ_buf_push(struct circ_ring *r, const char *src, int len)
+{
+    unsigned int mask = r->size - 1;
+    unsigned int head = READ_ONCE(r->ctrl->head) & mask;
+    // acquire：確保 consumer 已經讀完 tail 之前的資料，才能覆寫那段空間
+    unsigned int tail = smp_load_acquire(&r->ctrl->tail) & mask;
+    int first;
+
+    if (len > CIRC_SPACE(head, tail, r->size))
+        return -ENOSPC;
+
+    // 最多分兩段：head 到結尾，以及繞回開頭的部分
+    first = min(len, CIRC_SPACE_TO_END(head, tail, r->size));
+    memcpy(r->data + head, src, first);
+    memcpy(r->data, src + first, len - first);
+
+    // release：資料寫完後才發布新的 head
+    smp_store_release(&r->ctrl->head, (head + len) & mask);
+    return len;
+}
+
+// **Consumer：最多取出 len bytes，回傳實際取出的數量 (呼叫者需持有 cons_lock)**
+static int circ_buf_pop(struct circ_ring *r, char *dst, int len)
+{
+    unsigned int mask = r->size - 1;
+    unsigned int head, tail, old;
+    unsigned long seq;
+    int n, first;
+
+    do {
+        seq = circ_ring_read_begin(r);
+        old = READ_ONCE(r->ctrl->tail);
+        tail = old & mask;
+        // acquire：看到新的 head 時，head 之前的資料一定已經可見
+        head = smp_load_acquire(&r->ctrl->head) & mask;
+
+        n = min_t(int, len, CIRC_CNT(head, tail, r->size));
+        if (n == 0)
+            return 0;
+
+        first = min(n, CIRC_CNT_TO_END(head, tail, r->size));
+        memcpy(dst, r->data + tail, first);
+        memcpy(dst + first, r->data, n - first);
+        // release：資料讀完後才歸還空間給 producer
+    } while (!circ_ring_commit_tail(r, seq, old, (tail + n) & mask));
+    return n;
+}
+
+// **把 iter 裡的 len bytes 複製到 ring 的 pos 位置 (可能繞回開頭)，最多分兩段**
+// copy_from_iter() 同時支援 user space 的 write/writev 與 kernel 的 kvec
+static int circ_ring_copy_from_iter(struct circ_ring *r, unsigned int pos, unsigned int len,
+                                    struct iov_iter *from)
+{
+    unsigned int first = min(len, r->size - pos);
+
+    if (copy_from_iter(r->data + pos, first, from) != first ||
+        copy_from_iter(r->data, len - first, from) != len - first)
+        return -EFAULT;
+    return 0;
+}
 
-    if (copy_to_user(buf, kbuf, count))
+// **把 ring 的 pos 位置開始的 len bytes 複製到 iter，最多分兩段**
+static int circ_ring_copy_to_iter(struct circ_ring *r, unsigned int pos, unsigned int len,
+                                  struct iov_iter *to)
+{
+    unsigned int first = min(len, r->size - pos);
+
+    if (copy_to_iter(r->data + pos, first, to) != first ||
+        copy_to_iter(r->data, len - first, to) != len - first)
         return -EFAULT;
+    return 0;
+}
+
+// **Producer (iter 來源)：直接複製進 ring，不經過 bounce buffer**
+// 回傳實際寫入的 bytes (空間不足時可能小於 len，滿了回傳 0)
+static int circ_buf_push_iter(struct circ_ring *r, struct iov_iter *from, unsigned int len)
+{
+    unsigned int mask = r->size - 1;
+    unsigned int head = READ_ONCE(r->ctrl->head) & mask;
+    unsigned int tail = smp_load_acquire(&r->ctrl->tail) & mask;
+
+    len = min_t(unsigned int, len, CIRC_SPACE(head, tail, r->size));
+    if (len == 0)
+        return 0;
+
+    if (circ_ring_copy_from_iter(r, head, len, from))
+        return -EFAULT;  // head 還沒發布，寫一半的資料不會被看到
+
+    smp_store_release(&r->ctrl->head, (head + len) & mask);
+    return len;
+}
+
+// **Consumer (iter 目的地)：直接從 ring 複製出去**
+// 回傳實際讀出的 bytes，ring 空時回傳 0；複製期間被 overwrite 蓋掉就退回 iter 重讀
+static int circ_buf_pop_iter(struct circ_ring *r, struct iov_iter *to, unsigned int len)
+{
+    unsigned int mask = r->size - 1;
+    unsigned int head, tail, old, n;
+    unsigned long seq;
+
+    for (;;) {
+        seq = circ_ring_read_begin(r);
+        old = READ_ONCE(r->ctrl->tail);
+        tail = old & mask;
+        head = smp_load_acquire(&r->ctrl->head) & mask;
+
+        n = min_t(unsigned int, len, CIRC_CNT(head, tail, r->size));
+        if (n == 0)
+            return 0;
+
+        if (circ_ring_copy_to_iter(r, tail, n, to))
+            return -EFAULT;  // tail 不動，資料留在 ring 裡
+
+        if (circ_ring_commit_tail(r, seq, old, (tail + n) & mask))
+            return n;
+        iov_iter_revert(to, n);
+    }
+}
+
+// **Message 模式 producer：寫入一筆 record (header + payload)，全有或全無**
+// 空間不足回傳 -ENOSPC，成功回傳 payload 長度
+static int circ_buf_push_rec_iter(struct circ_ring *r, struct iov_iter *from, unsigned int len)
+{
+    struct circ_buf_rec hdr = {
+        .len = len,
+        .cpu = raw_smp_processor_id(),
+        .ts_ns = ktime_get_ns(),
+    };
+    unsigned int mask = r->size - 1;
+    unsigned int head = READ_ONCE(r->ctrl->head) & mask;
+    unsigned int tail = smp_load_acquire(&r->ctrl->tail) & mask;
+    unsigned int first;
+
+    if (sizeof(hdr) + len > CIRC_SPACE(head, tail, r->size))
+        return -ENOSPC;
+
+    first = min_t(unsigned int, sizeof(hdr), r->size - head);
+    memcpy(r->data + head, &hdr, first);
+    memcpy(r->data, (char *)&hdr + first, sizeof(hdr) - first);
+
+    if (circ_ring_copy_from_iter(r, (head + sizeof(hdr)) & mask, len, from))
+        return -EFAULT;
+
+    // header 和 payload 一起發布，consumer 不會看到半筆 record
+    smp_store_release(&r->ctrl->head, (head + sizeof(hdr) + len) & mask);
+    return len;
+}
+
+// **偷看 ring 上最舊那筆 record 的 header，ring 空回傳 false**
+static bool circ_ring_peek_rec(struct circ_ring *r, struct circ_buf_rec *hdr)
+{
+    unsigned int mask = r->size - 1;
+    unsigned int head = smp_load_acquire(&r->ctrl->head) & mask;
+    unsigned int tail = READ_ONCE(r->ctrl->tail) & mask;
+
+    if (CIRC_CNT(head, tail, r->size) < sizeof(*hdr))
+        return false;
+
+    circ_ring_read_at(r, tail, hdr, sizeof(*hdr));
+    return true;
+}
+
+// **Message 模式 consumer：取出一筆完整的 record (含 header) 到 iter**
+// ring 空回傳 0；剩餘 buffer 放不下這筆回傳 -EMSGSIZE
+static int circ_buf_pop_rec_iter(struct circ_ring *r, struct iov_iter *to)
+{
+    struct circ_buf_rec hdr;
+    unsigned int mask = r->size - 1;
+    unsigned int head, tail, old, cnt, total;
+    unsigned long seq;
+    int ret;
+
+    for (;;) {
+        seq = circ_ring_read_begin(r);
+        old = READ_ONCE(r->ctrl->tail);
+        tail = old & mask;
+        head = smp_load_acquire(&r->ctrl->head) & mask;
+        cnt = CIRC_CNT(head, tail, r->size);
+        if (cnt < sizeof(hdr))
+            return 0;
+
+        circ_ring_read_at(r, tail, &hdr, sizeof(hdr));
+        total = sizeof(hdr) + hdr.len;
+        // 長度不合理代表 mmap 的一方寫壞了 ring，或是 header 讀到一半被 overwrite 蓋掉
+        ret = hdr.len >= r->size || total > cnt ? -EIO :
+              total > iov_iter_count(to) ? -EMSGSIZE : 0;
+        if (ret) {
+            if (circ_ring_read_retry(r, seq))
+                continue;
+            return ret;
+        }
+
+        if (circ_ring_copy_to_iter(r, tail, total, to))
+            return -EFAULT;
+
+        if (circ_ring_commit_tail(r, seq, old, (tail + total) & mask))
+            return total;
+        iov_iter_revert(to, total);
+    }
+}
+
+// **Message 模式下該讀哪個 ring：挑最舊 (timestamp 最小) 的那筆 record**
+// 這樣 percpu 模式讀出來的 record 會依照寫入時間合併排序
+static struct circ_ring *circ_buf_oldest_ring(struct circ_dev *cd)
+{
+    struct circ_ring *r, *oldest = NULL;
+    struct circ_buf_rec hdr;
+    u64 ts = U64_MAX;
+    unsigned int i;
+
+    for (i = 0; i < circ_dev_nr_all(cd); i++) {
+        r = circ_dev_ring(cd, i);
+        if (!r->area || !circ_ring_peek_rec(r, &hdr))
+            continue;
+        if (hdr.ts_ns < ts) {
+            ts = hdr.ts_ns;
+            oldest = r;
+        }
+    }
+    return oldest;
+}
+
+// **overwrite 模式：丟掉最舊的資料直到 ring 至少有 need bytes 空間 (need < size)**
+// producer 直接用 cmpxchg 把 tail 往前搬，不拿 cons_lock，reader 正在複製或睡著都不會擋住 writer。
+// 搬之前先把 ow_seq 加一 (cmpxchg 是 full barrier，之後才會寫新資料)，
+// reader 複製完發現 ow_seq 變了或 tail 被搬過，就丟掉這次讀到的內容重讀。
+// reader 同時把 tail 往前推的話 cmpxchg 失敗，重新算一次；reader 只會讓空間變多，最後一定成功。
+// 呼叫者需持有 prod_lock (kring 則是關中斷)，同一個 ring 只有一個 producer 寫 ow_seq。
+// mmap 的 consumer 自己管 tail，不能和 overwrite 模式一起用。
+static void circ_buf_make_room(struct circ_dev *cd, struct circ_ring *r, unsigned int need)
+{
+    unsigned int mask = r->size - 1;
+    unsigned int head, tail, old, cnt, space, drop;
+    struct circ_buf_rec hdr;
+
+    for (;;) {
+        head = READ_ONCE(r->ctrl->head) & mask;
+        old = READ_ONCE(r->ctrl->tail);
+        tail = old & mask;
+        cnt = CIRC_CNT(head, tail, r->size);
+        space = CIRC_SPACE(head, tail, r->size);
+        if (space >= need)
+            return;
+
+        drop = 0;
+        if (!msg_mode) {
+            drop = need - space;
+        } else {
+            // message 模式只能整筆丟，不然 reader 會讀到半筆 record
+            while (space + drop < need && drop < cnt) {
+                circ_ring_read_at(r, (tail + drop) & mask, &hdr, sizeof(hdr));
+                if (hdr.len >= r->size || drop + sizeof(hdr) + hdr.len > cnt) {
+                    drop = cnt;  // record 壞掉了，整個清空
+                    break;
+                }
+                drop += sizeof(hdr) + hdr.len;
+            }
+        }
+
+        WRITE_ONCE(r->ow_seq, r->ow_seq + 1);
+        if (cmpxchg(&r->ctrl->tail, old, (tail + drop) & mask) == old) {
+            atomic64_add(drop, &cd->stat_overwritten);
+            return;
+        }
+    }
+}
+
+// **writev 的每個 iovec 是一筆 record；write() 或 kernel 的 kvec 整個 buffer 是一筆**
+static size_t circ_buf_seg_len(const struct iov_iter *from)
+{
+    if (iter_is_iovec(from))
+        return min(iov_iter_count(from), iter_iov(from)->iov_len - from->iov_offset);
+    return iov_iter_count(from);
+}
+
+// **ring 滿了：先放掉 prod_lock 再睡，醒來後重新拿鎖 (回傳錯誤時 prod_lock 已經放掉)**
+// 睡著的 writer 不佔著鎖，同一個 ring 的其他 writer (包括 O_NONBLOCK 的) 不會卡在 mutex 上
+static int circ_buf_wait_space(struct circ_dev *cd, struct circ_ring *r, unsigned int need)
+{
+    mutex_unlock(&r->prod_lock);
+    if (wait_event_interruptible(cd->write_wq, circ_ring_space(r) >= need))
+        return -ERESTARTSYS;
+    if (mutex_lock_interruptible(&r->prod_lock))
+        return -ERESTARTSYS;
+    return 0;
+}
+
+// **byte 模式寫入：複製時持有 prod_lock，放得下的 write 不會和其他 writer 的資料交錯**
+// block：ring 滿了就睡在 write_wq 上等 reader 騰出空間，O_NONBLOCK 則回傳已寫入的量或 -EAGAIN；
+// 睡的時候不持有 prod_lock，所以比剩餘空間大的 write 可能和其他 writer 交錯 (和 pipe 超過 PIPE_BUF 一樣)
+// reject：放不下整個 write 就回傳 -ENOSPC；overwrite：蓋掉最舊的資料，永遠不會等
+static ssize_t circ_buf_write_bytes(struct file *file, struct circ_dev *cd, struct circ_ring *r,
+                                   struct iov_iter *from)
+{
+    size_t done = 0;
+    int ret = 0;
+
+    if (mutex_lock_interruptible(&r->prod_lock))
+        return -ERESTARTSYS;
+
+    // producer 持有 prod_lock，空間只會變多，所以一開始檢查一次就夠了
+    if (overflow_policy == OVERFLOW_REJECT && iov_iter_count(from) > circ_ring_space(r)) {
+        atomic64_add(iov_iter_count(from), &cd->stat_dropped);
+        ret = -ENOSPC;
+        goto out;
+    }
+
+    while (iov_iter_count(from)) {
+        if (overflow_policy == OVERFLOW_OVERWRITE)
+            circ_buf_make_room(cd, r, min_t(size_t, iov_iter_count(from), r->size - 1));
+
+        ret = circ_buf_push_iter(r, from, min_t(size_t, iov_iter_count(from), r->size));
+        if (ret < 0)
+            break;
+        if (ret > 0) {
+            done += ret;
+            circ_buf_wake(&cd->read_wq);
+            continue;
+        }
+        if (file->f_flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            break;
+        }
+        ret = circ_buf_wait_space(cd, r, 1);
+        if (ret)
+            return done ? done : ret;
+    }
+out:
+    mutex_unlock(&r->prod_lock);
+    return done ? done : ret;
+}
+
+// **message 模式寫入：一次 writev 可以送出很多筆 record，每筆都在 prod_lock 下整筆寫入**
+static ssize_t circ_buf_write_recs(struct file *file, struct circ_dev *cd, struct circ_ring *r,
+                                  struct iov_iter *from)
+{
+    size_t done = 0, len;
+    int ret = 0;
+
+    if (mutex_lock_interruptible(&r->prod_lock))
+        return -ERESTARTSYS;
+
+    while (iov_iter_count(from)) {
+        len = circ_buf_seg_len(from);
+        if (len == 0) {
+            iov_iter_advance(from, 0);  // 跳過長度 0 的 iovec
+            continue;
+        }
+        if (sizeof(struct circ_buf_rec) + len > r->size - 1) {
+            ret = -EMSGSIZE;  // 這筆 record 永遠放不下
+            break;
+        }
+
+        ret = circ_buf_push_rec_iter(r, from, len);
+        if (ret >= 0) {
+            done += ret;
+            circ_buf_wake(&cd->read_wq);
+            continue;
+        }
+        if (ret != -ENOSPC)
+            break;
+        if (overflow_policy == OVERFLOW_REJECT) {
+            atomic64_add(len, &cd->stat_dropped);
+            break;
+        }
+        if (overflow_policy == OVERFLOW_OVERWRITE) {
+            circ_buf_make_room(cd, r, sizeof(struct circ_buf_rec) + len);
+            continue;
+        }
+        if (file->f_flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            break;
+        }
+        ret = circ_buf_wait_space(cd, r, sizeof(struct circ_buf_rec) + len);
+        if (ret)
+            return done ? done : ret;
+    }
+    mutex_unlock(&r->prod_lock);
+    return done ? done : ret;
+}
+
+// **寫入函式：支援 `echo "data" > /dev/circ_buf0` 與 writev()**
+static ssize_t circ_buf_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct file *file = iocb->ki_filp;
+    struct circ_dev *cd = file->private_data;
+    struct circ_ring *r = circ_buf_local_ring(cd);
+
+    if (!iov_iter_count(from))
+        return 0;
+
+    return msg_mode ? circ_buf_write_recs(file, cd, r, from) : circ_buf_write_bytes(file, cd, r, from);
+}
+
+// **byte 模式：從所有 ring 輪流取資料，回傳總共讀出的 bytes (呼叫者需持有 cons_lock)**
+// 每個 ring 內部保持寫入順序；不同 ring 之間沒有順序，需要邊界請用 message 模式
+static ssize_t circ_buf_drain_bytes(struct circ_dev *cd, struct iov_iter *to)
+{
+    struct circ_ring *r;
+    unsigned int i;
+    size_t done = 0;
+    int ret;
+
+    for (i = 0; i < circ_dev_nr_all(cd) && iov_iter_count(to); i++) {
+        r = circ_dev_ring(cd, (cd->next_ring + i) % circ_dev_nr_all(cd));
+        if (!r->area)
+            continue;
+        ret = circ_buf_pop_iter(r, to, min_t(size_t, iov_iter_count(to), r->size));
+        if (ret < 0)
+            return done ? done : ret;
+        done += ret;
+    }
+    // 下一次從下一個 ring 開始，避免某個忙碌的 CPU 餓死其他 ring
+    cd->next_ring = (cd->next_ring + 1) % circ_dev_nr_all(cd);
+    return done;
+}
+
+// **message 模式：依時間順序取出放得下的所有完整 record，每筆前面帶 struct circ_buf_rec**
+// 第一筆就放不下時回傳 -EMSGSIZE
+static ssize_t circ_buf_drain_recs(struct circ_dev *cd, struct iov_iter *to)
+{
+    struct circ_ring *r;
+    size_t done = 0;
+    int ret;
+
+    while ((r = circ_buf_oldest_ring(cd))) {
+        ret = circ_buf_pop_rec_iter(r, to);
+        if (ret <= 0)
+            return done ? done : ret;
+        done += ret;
+    }
+    return done;
+}
+
+// **讀取函式：支援 `cat /dev/circ_buf0` 與 readv()**
+// 沒有資料時睡在 read_wq 上，O_NONBLOCK 則回傳 -EAGAIN
+// cons_lock 只在取資料時持有，睡之前放掉，其他 reader (包括 O_NONBLOCK/epoll 的) 不會被擋住
+static ssize_t circ_buf_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct file *file = iocb->ki_filp;
+    struct circ_dev *cd = file->private_data;
+    ssize_t ret;
+
+    if (!iov_iter_count(to))
+        return 0;
+
+    for (;;) {
+        if (mutex_lock_interruptible(&cd->cons_lock))
+            return -ERESTARTSYS;
+        ret = msg_mode ? circ_buf_drain_recs(cd, to) : circ_buf_drain_bytes(cd, to);
+        mutex_unlock(&cd->cons_lock);
+
+        if (ret != 0)
+            break;
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(cd->read_wq, circ_buf_count_all(cd) > 0))
+            return -ERESTARTSYS;
+    }
+
+    if (ret > 0)
+        circ_buf_wake(&cd->write_wq);
+    return ret;
+}
+
+// **poll/epoll：可讀 = 任一 ring 有資料，可寫 = 這顆 CPU 的 ring 放得下最小的一筆寫入**
+// message 模式下 write 一定要整筆 header + payload 放得下才會前進，只剩幾個 byte 時
+// 回報 EPOLLOUT 會讓 O_NONBLOCK writer 一直拿到 -EAGAIN 空轉
+static __poll_t circ_buf_poll(struct file *file, poll_table *wait)
+{
+    struct circ_dev *cd = file->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(file, &cd->read_wq, wait);
+    poll_wait(file, &cd->write_wq, wait);
+
+    if (circ_buf_count_all(cd))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (circ_ring_space(circ_buf_local_ring(cd)) >= (msg_mode ? CIRC_BUF_REC_MIN : 1))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    return mask;
+}
+
+// **ioctl：mmap 的 producer/consumer 更新完 head/tail 後，叫醒等待的另一方**
+static long circ_buf_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct circ_dev *cd = file->private_data;
 
-    return count;
+    switch (cmd) {
+    case CIRC_BUF_IOC_KICK:
+        circ_buf_wake(&cd->read_wq);
+        circ_buf_wake(&cd->write_wq);
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+// **mmap：offset 0 是控制頁，接著是資料區，user space 可以直接在共享記憶體上生產/消費**
+// percpu 模式下第 N 個 ring 從 N * (控制頁 + 資料頁) 的 offset 開始，
+// 所有 rings 之後接著每顆 CPU 的 krings (以 kring_size 計算頁數)
+static int circ_buf_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct circ_dev *cd = file->private_data;
+    unsigned long pages = (PAGE_SIZE + PAGE_ALIGN(ring_size)) >> PAGE_SHIFT;
+    unsigned long pgoff = vma->vm_pgoff;
+    struct circ_ring *r;
+
+    if (pgoff < cd->nr_rings * pages) {
+        r = &cd->rings[pgoff / pages];
+    } else {
+        if (!cd->nr_krings)
+            return -EINVAL;
+        pgoff -= cd->nr_rings * pages;
+        pages = (PAGE_SIZE + PAGE_ALIGN(kring_size)) >> PAGE_SHIFT;
+        if (pgoff / pages >= cd->nr_krings)
+            return -EINVAL;
+        r = &cd->krings[pgoff / pages];
+    }
+    if (!r->area)
+        return -EINVAL;
+
+    // remap_vmalloc_range() 會檢查 offset + 長度不超過 area 大小
+    return remap_vmalloc_range(vma, r->area, pgoff % pages);
 }
 
-// **設備開啟**
+// **設備開啟：依 minor 找到對應的 instance**
 static int circ_buf_open(struct inode *inode, struct file *file)
 {
+    file->private_data = container_of(inode->i_cdev, struct circ_dev, cdev);
     return 0;
 }
 
@@ -73,44 +766,542 @@ static struct file_operations fops = {
     .owner = THIS_MODULE,
     .open = circ_buf_open,
     .release = circ_buf_release,
-    .read = circ_buf_read,
-    .write = circ_buf_write,
+    .read_iter = circ_buf_read_iter,
+    .write_iter = circ_buf_write_iter,
+    .mmap = circ_buf_mmap,
+    .poll = circ_buf_poll,
+    .unlocked_ioctl = circ_buf_ioctl,
+};
+
+// **把一筆事件放進 kring (呼叫者需關中斷，或確定沒有其他 producer)，回傳值同 circ_buf_log()**
+static int circ_buf_kring_push(struct circ_dev *cd, struct circ_ring *r, const void *data, size_t len)
+{
+    size_t need = (msg_mode ? sizeof(struct circ_buf_rec) : 0) + len;
+
+    if (need > r->size - 1)
+        return -EMSGSIZE;
+    if (overflow_policy == OVERFLOW_OVERWRITE)
+        circ_buf_make_room(cd, r, need);
+    if (msg_mode) {
+        struct kvec kv = { .iov_base = (void *)data, .iov_len = len };
+        struct iov_iter iter;
+
+        iov_iter_kvec(&iter, ITER_SOURCE, &kv, 1, len);
+        return circ_buf_push_rec_iter(r, &iter, len);
+    }
+    return circ_buf_push(r, data, len);
+}
+
+// **Kernel 內部的 producer API：其他 driver 直接把事件丟進 /dev/circ_bufN，不需要 syscall 也不需要 copy_from_user**
+// 可以在 process / softirq / hardirq context 呼叫 (NMI 除外)。資料寫進目前 CPU 的 kring，
+// 關中斷就保證這顆 CPU 上同時只有一個 producer，不需要任何鎖；永遠不會睡。
+// ring 滿了依 overflow 設定：overwrite 蓋掉這個 kring 最舊的資料，其他直接丟棄並計入 dropped。
+int circ_buf_log(unsigned int minor, const void *data, size_t len)
+{
+    struct circ_dev *cd;
+    struct circ_ring *r;
+    unsigned long flags;
+    int ret;
+
+    if (!devs || minor >= nr_devs)
+        return -ENODEV;
+    cd = &devs[minor];
+    if (!cd->nr_krings)
+        return -ENODEV;
+
+    local_irq_save(flags);
+    r = &cd->krings[smp_processor_id()];
+    ret = circ_buf_kring_push(cd, r, data, len);
+    local_irq_restore(flags);
+
+    if (ret == -ENOSPC)
+        atomic64_add(len, &cd->stat_dropped);
+    else if (ret >= 0)
+        circ_buf_wake(&cd->read_wq);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(circ_buf_log);
+
+// **debugfs：cat /sys/kernel/debug/circ_buf/circ_bufN/stats**
+static int circ_buf_stats_show(struct seq_file *m, void *v)
+{
+    struct circ_dev *cd = m->private;
+
+    seq_printf(m, "policy: %s\n", overflow_names[overflow_policy]);
+    seq_printf(m, "rings: %u\n", percpu ? num_possible_cpus() : 1);
+    seq_printf(m, "kernel_rings: %u\n", kring_size ? num_possible_cpus() : 0);
+    seq_printf(m, "queued_bytes: %u\n", circ_buf_count_all(cd));
+    seq_printf(m, "dropped_bytes: %lld\n", atomic64_read(&cd->stat_dropped));
+    seq_printf(m, "overwritten_bytes: %lld\n", atomic64_read(&cd->stat_overwritten));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(circ_buf_stats);
+
+// **配置 ring：控制頁 + 資料頁放在同一塊 vmalloc_user() 記憶體，方便整段 mmap**
+static int circ_ring_alloc(struct circ_ring *r, unsigned int size)
+{
+    mutex_init(&r->prod_lock);
+    r->area = vmalloc_user(PAGE_SIZE + PAGE_ALIGN(size));
+    if (!r->area)
+        return -ENOMEM;
+
+    r->ctrl = r->area;
+    r->data = (char *)r->area + PAGE_SIZE;
+    r->size = size;
+    r->ctrl->size = size;
+    r->ctrl->data_offset = PAGE_SIZE;
+    return 0;
+}
+
+static void circ_ring_free(struct circ_ring *r)
+{
+    vfree(r->area);
+    r->area = NULL;
+}
+
+// **kbench：在 hardirq context (irq_work) 裡放 N 筆事件，量每筆事件花幾 ns**
+//   echo 100000 > /sys/kernel/debug/circ_buf/kbench && cat /sys/kernel/debug/circ_buf/kbench
+// 寫進一個私有的 kring (和 kring_size 一樣大)，不會混進 /dev/circ_buf0 的資料和統計。
+// 每次 irq_work 最多放滿一個 ring 就倒空，量到的都是真的放進去的事件，不是 ring 滿了的丟棄路徑；
+// 每次只關一小段中斷，不會一次關掉 1M 次呼叫那麼久。
+#define KBENCH_EVENT_SIZE 64
+#define KBENCH_MAX_EVENTS 1000000
+
+struct circ_buf_kbench {
+    struct irq_work work;
+    struct completion done;
+    struct circ_dev cd;           // 只用到統計和 waitqueue
+    struct circ_ring ring;
+    unsigned long batch;          // 這次 irq_work 要放幾筆
+    unsigned long ok;
+    u64 ns;
+};
+
+// 上一次的結果；只存數字，irq_work 和 completion 不能複製
+struct circ_buf_kbench_result {
+    unsigned long events;
+    unsigned long ok;
+    u64 ns;
+};
+
+static DEFINE_MUTEX(kbench_lock);
+static struct circ_buf_kbench_result kbench_last;   // 受 kbench_lock 保護
+
+static void circ_buf_kbench_fn(struct irq_work *work)
+{
+    struct circ_buf_kbench *kb = container_of(work, struct circ_buf_kbench, work);
+    char event[KBENCH_EVENT_SIZE];
+    unsigned long i;
+    u64 start;
+
+    memset(event, 'k', sizeof(event));
+    start = ktime_get_ns();
+    for (i = 0; i < kb->batch; i++) {
+        if (circ_buf_kring_push(&kb->cd, &kb->ring, event, sizeof(event)) >= 0)
+            kb->ok++;
+    }
+    kb->ns += ktime_get_ns() - start;
+
+    // 沒有 reader，直接把 ring 倒空給下一批用
+    WRITE_ONCE(kb->ring.ctrl->tail, kb->ring.ctrl->head);
+    complete(&kb->done);
+}
+
+static ssize_t circ_buf_kbench_write(struct file *file, const char __user *buf,
+                                     size_t count, loff_t *ppos)
+{
+    struct circ_buf_kbench *kb;
+    unsigned long events, left, batch;
+    int ret;
+
+    ret = kstrtoul_from_user(buf, count, 0, &events);
+    if (ret)
+        return ret;
+    if (!events || events > KBENCH_MAX_EVENTS)
+        return -EINVAL;
+    if (!kring_size)
+        return -ENODEV;
+    // 一個 ring 放得下幾筆
+    batch = (kring_size - 1) / (KBENCH_EVENT_SIZE + (msg_mode ? sizeof(struct circ_buf_rec) : 0));
+    if (!batch)
+        return -EMSGSIZE;
+
+    kb = kzalloc(sizeof(*kb), GFP_KERNEL);
+    if (!kb)
+        return -ENOMEM;
+    ret = circ_ring_alloc(&kb->ring, kring_size);
+    if (ret)
+        goto out;
+    init_waitqueue_head(&kb->cd.read_wq);
+    init_waitqueue_head(&kb->cd.write_wq);
+    init_completion(&kb->done);
+    init_irq_work(&kb->work, circ_buf_kbench_fn);
+
+    mutex_lock(&kbench_lock);
+    for (left = events; left; left -= kb->batch) {
+        kb->batch = min(left, batch);
+        reinit_completion(&kb->done);
+        irq_work_queue(&kb->work);
+        wait_for_completion(&kb->done);
+        irq_work_sync(&kb->work);   // callback 完全結束後才能改 kb 或釋放
+    }
+    kbench_last.events = events;
+    kbench_last.ok = kb->ok;
+    kbench_last.ns = kb->ns;
+    mutex_unlock(&kbench_lock);
+
+    pr_info("circ_buf kbench: %lu events (%lu queued, %lu dropped) in %llu ns, %llu ns/event\n",
+            events, kb->ok, events - kb->ok, kb->ns, kb->ok ? div64_u64(kb->ns, kb->ok) : 0);
+    ret = count;
+out:
+    circ_ring_free(&kb->ring);
+    kfree(kb);
+    return ret;
+}
+
+static int circ_buf_kbench_show(struct seq_file *m, void *v)
+{
+    mutex_lock(&kbench_lock);
+    if (kbench_last.events)
+        seq_printf(m, "events: %lu\nqueued: %lu\ndropped: %lu\nns_per_event: %llu\n",
+                   kbench_last.events, kbench_last.ok, kbench_last.events - kbench_last.ok,
+                   kbench_last.ok ? div64_u64(kbench_last.ns, kbench_last.ok) : 0);
+    mutex_unlock(&kbench_lock);
+    return 0;
+}
+
+static int circ_buf_kbench_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, circ_buf_kbench_show, NULL);
+}
+
+static const struct file_operations circ_buf_kbench_fops = {
+    .owner = THIS_MODULE,
+    .open = circ_buf_kbench_open,
+    .read = seq_read,
+    .write = circ_buf_kbench_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+// **SPSC selftest：producer / consumer 兩個 kthread 綁在不同 CPU 上對打**
+#define SELFTEST_CHUNK 32
+
+struct circ_buf_selftest {
+    struct circ_dev *cd;
+    struct circ_ring *ring;
+    unsigned long total;
+    unsigned long errors;
+    struct completion done;   // 兩個 thread 各 complete() 一次
 };
 
+static int circ_buf_selftest_producer(void *data)
+{
+    struct circ_buf_selftest *st = data;
+    char chunk[SELFTEST_CHUNK];
+    unsigned long sent = 0;
+    unsigned char seq = 0;
+    int i, n, ret;
+
+    while (sent < st->total) {
+        // ring 很小時 (例如 ring_size=2) 一次只能放 size - 1 bytes
+        n = min_t(unsigned long, min_t(unsigned int, SELFTEST_CHUNK, st->ring->size - 1),
+                  st->total - sent);
+        for (i = 0; i < n; i++)
+            chunk[i] = seq + i;
+
+        mutex_lock(&st->ring->prod_lock);
+        ret = circ_buf_push(st->ring, chunk, n);
+        mutex_unlock(&st->ring->prod_lock);
+
+        if (ret < 0) {
+            cond_resched();  // ring 滿了，讓 consumer 跑
+            continue;
+        }
+        seq += n;
+        sent += n;
+    }
+    complete(&st->done);
+    return 0;
+}
+
+static int circ_buf_selftest_consumer(void *data)
+{
+    struct circ_buf_selftest *st = data;
+    char chunk[SELFTEST_CHUNK];
+    unsigned long received = 0;
+    unsigned char seq = 0;
+    int i, n;
+
+    while (received < st->total) {
+        mutex_lock(&st->cd->cons_lock);
+        n = circ_buf_pop(st->ring, chunk, SELFTEST_CHUNK);
+        mutex_unlock(&st->cd->cons_lock);
+
+        if (n == 0) {
+            cond_resched();  // ring 空了，讓 producer 跑
+            continue;
+        }
+        for (i = 0; i < n; i++, seq++) {
+            if ((unsigned char)chunk[i] != seq)
+                st->errors++;
+        }
+        received += n;
+    }
+    complete(&st->done);
+    return 0;
+}
+
+static int circ_buf_selftest(struct circ_dev *cd, unsigned long total)
+{
+    struct circ_buf_selftest st = { .cd = cd, .ring = &cd->rings[0], .total = total };
+    struct task_struct *producer, *consumer;
+    unsigned int cpu0, cpu1;
+    ktime_t start;
+    u64 ns;
+
+    init_completion(&st.done);
+    cpu0 = cpumask_first(cpu_online_mask);
+    cpu1 = cpumask_next(cpu0, cpu_online_mask);
+    if (cpu1 >= nr_cpu_ids) {
+        pr_warn("circ_buf selftest: only one CPU online, running both threads on CPU %u\n", cpu0);
+        cpu1 = cpu0;
+    }
+
+    producer = kthread_create(circ_buf_selftest_producer, &st, "circ_buf_prod");
+    if (IS_ERR(producer))
+        return PTR_ERR(producer);
+    consumer = kthread_create(circ_buf_selftest_consumer, &st, "circ_buf_cons");
+    if (IS_ERR(consumer)) {
+        kthread_stop(producer);
+        return PTR_ERR(consumer);
+    }
+    kthread_bind(producer, cpu0);
+    kthread_bind(consumer, cpu1);
+
+    // thread 結束後 task_struct 可能馬上被回收，先握住再 kthread_stop()
+    get_task_struct(producer);
+    get_task_struct(consumer);
+
+    start = ktime_get();
+    wake_up_process(producer);
+    wake_up_process(consumer);
+    // 不能直接 kthread_stop()：thread 還沒開始跑就被 stop 的話 threadfn 根本不會執行
+    wait_for_completion(&st.done);
+    wait_for_completion(&st.done);
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    kthread_stop(producer);
+    kthread_stop(consumer);
+
+    put_task_struct(producer);
+    put_task_struct(consumer);
+
+    if (st.errors) {
+        pr_err("circ_buf selftest: %lu corrupted bytes out of %lu\n", st.errors, total);
+        return -EIO;
+    }
+
+    pr_info("circ_buf selftest: %lu bytes CPU%u -> CPU%u in %llu ns (%llu bytes/sec)\n",
+            total, cpu0, cpu1, ns, ns ? mul_u64_u64_div_u64(total, NSEC_PER_SEC, ns) : 0);
+    return 0;
+}
+
+// **配置一個 instance 的所有 ring：percpu 模式下以 CPU 編號為 index，每顆 possible CPU 一個**
+static int circ_dev_alloc(struct circ_dev *cd, unsigned int minor)
+{
+    unsigned int cpu;
+    int ret;
+
+    cd->minor = minor;
+    mutex_init(&cd->cons_lock);
+    init_waitqueue_head(&cd->read_wq);
+    init_waitqueue_head(&cd->write_wq);
+    atomic64_set(&cd->stat_dropped, 0);
+    atomic64_set(&cd->stat_overwritten, 0);
+
+    cd->nr_rings = percpu ? nr_cpu_ids : 1;
+    cd->rings = kcalloc(cd->nr_rings, sizeof(*cd->rings), GFP_KERNEL);
+    if (!cd->rings)
+        return -ENOMEM;
+
+    if (!percpu) {
+        ret = circ_ring_alloc(&cd->rings[0], ring_size);
+        if (ret)
+            return ret;
+    } else {
+        for_each_possible_cpu(cpu) {
+            ret = circ_ring_alloc(&cd->rings[cpu], ring_size);
+            if (ret)
+                return ret;
+        }
+    }
+
+    if (!kring_size)
+        return 0;
+
+    cd->nr_krings = nr_cpu_ids;
+    cd->krings = kcalloc(cd->nr_krings, sizeof(*cd->krings), GFP_KERNEL);
+    if (!cd->krings)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu) {
+        ret = circ_ring_alloc(&cd->krings[cpu], kring_size);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+static void circ_dev_free(struct circ_dev *cd)
+{
+    unsigned int i;
+
+    if (cd->krings) {
+        for (i = 0; i < cd->nr_krings; i++)
+            circ_ring_free(&cd->krings[i]);
+        kfree(cd->krings);
+        cd->krings = NULL;
+    }
+    if (cd->rings) {
+        for (i = 0; i < cd->nr_rings; i++)
+            circ_ring_free(&cd->rings[i]);
+        kfree(cd->rings);
+        cd->rings = NULL;
+    }
+}
+
+// **註冊一個 instance：cdev + /dev/circ_bufN + debugfs**
+static int circ_dev_register(struct circ_dev *cd)
+{
+    dev_t devt = MKDEV(MAJOR(dev_base), cd->minor);
+    struct device *device;
+    struct dentry *dir;
+    int ret;
+
+    cdev_init(&cd->cdev, &fops);
+    cd->cdev.owner = THIS_MODULE;
+    ret = cdev_add(&cd->cdev, devt, 1);
+    if (ret < 0)
+        return ret;
+
+    device = device_create(circ_buf_class, NULL, devt, cd, DEVICE_NAME "%u", cd->minor);
+    if (IS_ERR(device)) {
+        cdev_del(&cd->cdev);
+        return PTR_ERR(device);
+    }
+
+    dir = debugfs_create_dir(dev_name(device), debugfs_dir);
+    debugfs_create_file("stats", 0444, dir, cd, &circ_buf_stats_fops);
+    return 0;
+}
+
+static void circ_dev_unregister(struct circ_dev *cd)
+{
+    device_destroy(circ_buf_class, MKDEV(MAJOR(dev_base), cd->minor));
+    cdev_del(&cd->cdev);
+}
+
+// **釋放所有 instance (已註冊的先拆掉設備節點)**
+static void circ_buf_teardown(void)
+{
+    unsigned int i;
+
+    debugfs_remove_recursive(debugfs_dir);
+    for (i = 0; i < nr_registered; i++)
+        circ_dev_unregister(&devs[i]);
+    nr_registered = 0;
+
+    if (!IS_ERR_OR_NULL(circ_buf_class))
+        class_destroy(circ_buf_class);
+    if (dev_base)
+        unregister_chrdev_region(dev_base, nr_devs);
+
+    if (devs) {
+        for (i = 0; i < nr_devs; i++)
+            circ_dev_free(&devs[i]);
+        kfree(devs);
+        devs = NULL;
+    }
+}
+
 // **模組初始化**
 static int __init circ_buf_init(void)
 {
-    if (alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME) < 0) {
-        printk(KERN_ERR "Failed to allocate device number\n");
-        return -1;
+    unsigned int i;
+    int ret;
+
+    if (!is_power_of_2(ring_size) || ring_size < 2 || ring_size > RING_SIZE_MAX) {
+        pr_err("circ_buf: ring_size %u must be a power of two between 2 and %u\n",
+               ring_size, RING_SIZE_MAX);
+        return -EINVAL;
+    }
+    if (kring_size && (!is_power_of_2(kring_size) || kring_size < 2 || kring_size > RING_SIZE_MAX)) {
+        pr_err("circ_buf: kring_size %u must be 0 or a power of two between 2 and %u\n",
+               kring_size, RING_SIZE_MAX);
+        return -EINVAL;
+    }
+    if (nr_devs < 1 || nr_devs > CIRC_BUF_MAX_DEVS) {
+        pr_err("circ_buf: nr_devs %u must be between 1 and %u\n", nr_devs, CIRC_BUF_MAX_DEVS);
+        return -EINVAL;
     }
 
-    cdev_init(&my_cdev, &fops);
-    if (cdev_add(&my_cdev, dev_num, 1) < 0) {
-        unregister_chrdev_region(dev_num, 1);
-        return -1;
+    overflow_policy = sysfs_match_string(overflow_names, overflow);
+    if (overflow_policy < 0) {
+        pr_err("circ_buf: unknown overflow policy '%s'\n", overflow);
+        return -EINVAL;
     }
 
-    // 初始化環形緩衝區
-    my_circ_buf.buf = kmalloc(BUF_SIZE, GFP_KERNEL);
-    if (!my_circ_buf.buf) {
-        cdev_del(&my_cdev);
-        unregister_chrdev_region(dev_num, 1);
+    // 初始化環形緩衝區 (vmalloc_user 已經清零，head = tail = 0)
+    // 要在 cdev_add() 之前完成，設備一出現就可能被 open/mmap
+    devs = kcalloc(nr_devs, sizeof(*devs), GFP_KERNEL);
+    if (!devs)
         return -ENOMEM;
+    for (i = 0; i < nr_devs; i++) {
+        ret = circ_dev_alloc(&devs[i], i);
+        if (ret)
+            goto err;
     }
-    my_circ_buf.head = 0;
-    my_circ_buf.tail = 0;
 
-    printk(KERN_INFO "Circular buffer device initialized as /dev/%s\n", DEVICE_NAME);
+    if (selftest_bytes) {
+        ret = circ_buf_selftest(&devs[0], selftest_bytes);
+        if (ret)
+            goto err;
+    }
+
+    ret = alloc_chrdev_region(&dev_base, 0, nr_devs, DEVICE_NAME);
+    if (ret < 0) {
+        printk(KERN_ERR "Failed to allocate device number\n");
+        goto err;
+    }
+
+    circ_buf_class = class_create(DEVICE_NAME);
+    if (IS_ERR(circ_buf_class)) {
+        ret = PTR_ERR(circ_buf_class);
+        goto err;
+    }
+
+    debugfs_dir = debugfs_create_dir(DEVICE_NAME, NULL);
+    debugfs_create_file("kbench", 0600, debugfs_dir, NULL, &circ_buf_kbench_fops);
+
+    for (i = 0; i < nr_devs; i++) {
+        ret = circ_dev_register(&devs[i]);
+        if (ret)
+            goto err;
+        nr_registered++;
+    }
+
+    printk(KERN_INFO "Circular buffer devices initialized as /dev/%s0..%u (%u x %u bytes each)\n",
+           DEVICE_NAME, nr_devs - 1, percpu ? num_possible_cpus() : 1, ring_size);
     return 0;
+
+err:
+    circ_buf_teardown();
+    return ret;
 }
 
 // **模組卸載**
 static void __exit circ_buf_exit(void)
 {
-    kfree(my_circ_buf.buf);
-    cdev_del(&my_cdev);
-    unregister_chrdev_region(dev_num, 1);
+    circ_buf_teardown();
     printk(KERN_INFO "Circular buffer device removed\n");
 }
 
@@ -120,4 +1311,3 @@ module_exit(circ_buf_exit);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Nick Huang");
 MODULE_DESCRIPTION("Circular Buffer Device Driver");
-
@@ -0,0 +1,585 @@
+/*
+ * circ_buf_bench.c
+ * User space benchmark for /dev/circ_bufN
+ *
+ * -L  wakeup latency (default): producer writes a CLOCK_MONOTONIC timestamp,
+ *     the consumer sleeps in read() (or poll() with -p) and records
+ *     now - timestamp when it wakes up.
+ * -T  throughput: -P producers write -n records of -s bytes in total
+ *     (-b records per writev), -C consumers read with a large buffer.
+ *     With -m the module must be loaded with msg_mode=1; consumers then
+ *     parse whole records and also report per-record latency.
+ *     With -M mmap one producer and one consumer share ring 0 through mmap
+ *     (module loaded with percpu=0 msg_mode=0) and only use ioctl(KICK)
+ *     and poll() to wake each other.
+ *
+ * Every run prints throughput, latency percentiles (p50/p99/p999) where
+ * records can be timestamped, and the CPU time spent by the whole process.
+ *
+ *   ./circ_buf_bench [-L|-T] [-d dev] [-n count] [-i interval_us] [-p]
+ *                    [-s size] [-b batch] [-m] [-P producers] [-C consumers]
+ *                    [-M rw|mmap]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+
+#include "circ_buf_uapi.h"
+
+#define DEFAULT_DEV "/dev/circ_buf0"
+#define READ_BUF_SIZE (1 << 20)
+#define MAX_BATCH 1024
+#define MAX_THREADS 256
+#define POLL_TIMEOUT_MS 100
+
+enum { IO_RW, IO_MMAP };
+
+static const char *dev_path = DEFAULT_DEV;
+static int samples = 10000;
+static int interval_us = 200;
+static int use_poll;
+static int throughput;
+static int rec_size = 64;
+static int batch = 1;
+static int msg_mode;
+static int producers = 1;
+static int consumers = 1;
+static int io_mode = IO_RW;
+
+// throughput 模式各執行緒共用的狀態
+static uint64_t *lat;            // 每筆 record 的延遲 (ns)
+static uint64_t lat_n;           // 已記錄的筆數
+static uint64_t consumed;        // 所有 consumer 合計讀到的 bytes
+static uint64_t end_ns;          // 最後一個 byte 被讀到的時間
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t cpu_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull +
+           ((uint64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+}
+
+static void wait_readable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    if (use_poll)
+        poll(&pfd, 1, -1);
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n;
+
+        wait_readable(fd);
+        n = read(fd, (char *)buf + done, len - done);
+        if (n < 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int open_consumer(void)
+{
+    int fd = open(dev_path, O_RDONLY | (use_poll ? O_NONBLOCK : 0));
+
+    if (fd < 0) {
+        perror("open consumer");
+        exit(1);
+    }
+    return fd;
+}
+
+static void record_latency(uint64_t ts)
+{
+    uint64_t i = __atomic_fetch_add(&lat_n, 1, __ATOMIC_RELAXED);
+
+    if (i < (uint64_t)samples)
+        lat[i] = now_ns() - ts;
+}
+
+static void report(const char *name, uint64_t *v, uint64_t n)
+{
+    uint64_t sum = 0, i;
+
+    if (!n) {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    qsort(v, n, sizeof(*v), cmp_u64);
+    for (i = 0; i < n; i++)
+        sum += v[i];
+
+    printf("%s: n=%llu min=%llu avg=%llu p50=%llu p99=%llu p999=%llu max=%llu (ns)\n", name,
+           (unsigned long long)n, (unsigned long long)v[0], (unsigned long long)(sum / n),
+           (unsigned long long)v[n / 2], (unsigned long long)v[n * 99 / 100],
+           (unsigned long long)v[n * 999 / 1000], (unsigned long long)v[n - 1]);
+}
+
+static void report_cpu(uint64_t cpu, uint64_t wall, uint64_t recs)
+{
+    printf("cpu: %.3f ms (%.0f%% of one core), %.0f ns/record\n", cpu / 1e6,
+           wall ? cpu * 100.0 / wall : 0.0, recs ? (double)cpu / recs : 0.0);
+}
+
+/* ---------------- wakeup latency ---------------- */
+
+static void *latency_consumer(void *arg)
+{
+    int fd = open_consumer();
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        struct {
+            struct circ_buf_rec hdr;
+            uint64_t ts;
+        } rec;
+        int ret;
+
+        // msg 模式下每次 read 會帶回 header + 8 bytes payload
+        if (msg_mode)
+            ret = read_full(fd, &rec, sizeof(rec));
+        else
+            ret = read_full(fd, &rec.ts, sizeof(rec.ts));
+        if (ret < 0) {
+            perror("read");
+            exit(1);
+        }
+        lat[i] = now_ns() - rec.ts;
+    }
+    close(fd);
+    return NULL;
+}
+
+static int run_latency(void)
+{
+    uint64_t start, cpu;
+    pthread_t tid;
+    int fd, i;
+
+    lat = calloc(samples, sizeof(*lat));
+    fd = open(dev_path, O_WRONLY);
+    if (!lat || fd < 0) {
+        perror("open producer");
+        return 1;
+    }
+
+    pthread_create(&tid, NULL, latency_consumer, NULL);
+    usleep(10000);  // 讓 consumer 先進入等待
+
+    start = now_ns();
+    cpu = cpu_ns();
+    for (i = 0; i < samples; i++) {
+        uint64_t ts = now_ns();
+
+        if (write(fd, &ts, sizeof(ts)) != sizeof(ts)) {
+            perror("write");
+            return 1;
+        }
+        usleep(interval_us);  // 確保 consumer 每次都是從睡眠中被叫醒
+    }
+
+    pthread_join(tid, NULL);
+    cpu = cpu_ns() - cpu;
+    close(fd);
+
+    report(use_poll ? "wakeup latency (poll)" : "wakeup latency (read)", lat, samples);
+    report_cpu(cpu, now_ns() - start, samples);
+    free(lat);
+    return 0;
+}
+
+/* ---------------- throughput: read()/write() ---------------- */
+
+static uint64_t bytes_per_rec(void)
+{
+    return msg_mode ? sizeof(struct circ_buf_rec) + rec_size : (uint64_t)rec_size;
+}
+
+// 第 id 個 producer 要寫的筆數 (餘數分給前面幾個)
+static int producer_share(int id)
+{
+    return samples / producers + (id < samples % producers);
+}
+
+static void *rw_producer(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    int total = producer_share(id);
+    struct iovec iov[MAX_BATCH];
+    char *payload;
+    int fd, i, sent;
+
+    payload = malloc((size_t)batch * rec_size);
+    fd = open(dev_path, O_WRONLY);
+    if (!payload || fd < 0) {
+        perror("open producer");
+        exit(1);
+    }
+    memset(payload, 'x', (size_t)batch * rec_size);
+    for (i = 0; i < batch; i++) {
+        iov[i].iov_base = payload + (size_t)i * rec_size;
+        iov[i].iov_len = rec_size;
+    }
+
+    for (sent = 0; sent < total; ) {
+        int n = total - sent < batch ? total - sent : batch;
+        uint64_t ts = now_ns();
+        ssize_t ret;
+
+        // payload 開頭放送出時間，msg 模式的 consumer 用來算延遲
+        if (rec_size >= (int)sizeof(ts)) {
+            for (i = 0; i < n; i++)
+                memcpy(iov[i].iov_base, &ts, sizeof(ts));
+        }
+        ret = writev(fd, iov, n);
+        if (ret < 0) {
+            perror("writev");
+            exit(1);
+        }
+        if (ret != (ssize_t)n * rec_size) {
+            fprintf(stderr, "short writev: %zd\n", ret);
+            exit(1);
+        }
+        sent += n;
+    }
+
+    close(fd);
+    free(payload);
+    return NULL;
+}
+
+static int consume_done(void)
+{
+    return __atomic_load_n(&consumed, __ATOMIC_ACQUIRE) >= (uint64_t)samples * bytes_per_rec();
+}
+
+// 多個 consumer 時一律用 poll() + timeout：最後一筆被別人讀走的 consumer 才不會永遠睡在 read() 裡
+static void *rw_consumer(void *arg)
+{
+    uint64_t want = (uint64_t)samples * bytes_per_rec();
+    int multi = consumers > 1;
+    char *buf = malloc(READ_BUF_SIZE);
+    int fd = open(dev_path, O_RDONLY | (use_poll || multi ? O_NONBLOCK : 0));
+
+    if (!buf || fd < 0) {
+        perror("open consumer");
+        exit(1);
+    }
+
+    while (!consume_done()) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        ssize_t n, off = 0;
+
+        if (use_poll || multi) {
+            if (poll(&pfd, 1, POLL_TIMEOUT_MS) == 0)
+                continue;
+        }
+        n = read(fd, buf, READ_BUF_SIZE);
+        if (n < 0 && errno == EAGAIN)
+            continue;
+        if (n < 0) {
+            perror("read");
+            exit(1);
+        }
+        // msg 模式：逐筆走過 header，確認 read 沒有切斷 record
+        while (msg_mode && off < n) {
+            struct circ_buf_rec *hdr = (struct circ_buf_rec *)(buf + off);
+            uint64_t ts;
+
+            if (hdr->len >= sizeof(ts)) {
+                memcpy(&ts, hdr + 1, sizeof(ts));
+                record_latency(ts);
+            }
+            off += sizeof(*hdr) + hdr->len;
+        }
+        if (msg_mode && off != n) {
+            fprintf(stderr, "read returned a partial record\n");
+            exit(1);
+        }
+        if (__atomic_add_fetch(&consumed, n, __ATOMIC_ACQ_REL) >= want)
+            end_ns = now_ns();
+    }
+
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+/* ---------------- throughput: mmap ---------------- */
+
+struct ring_map {
+    struct circ_buf_ctrl *ctrl;
+    char *data;
+    size_t len;
+};
+
+// 先 mmap 控制頁讀出 size/data_offset，再 mmap 整個 ring 0
+static int map_ring(int fd, struct ring_map *m)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    struct circ_buf_ctrl *ctrl;
+
+    ctrl = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+    if (ctrl == MAP_FAILED)
+        return -1;
+    m->len = ctrl->data_offset + ((ctrl->size + page - 1) & ~(page - 1));
+    munmap(ctrl, page);
+
+    m->ctrl = mmap(NULL, m->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m->ctrl == MAP_FAILED)
+        return -1;
+    m->data = (char *)m->ctrl + m->ctrl->data_offset;
+    return 0;
+}
+
+static int open_mapped(struct ring_map *m)
+{
+    int fd = open(dev_path, O_RDWR | O_NONBLOCK);
+
+    if (fd < 0 || map_ring(fd, m) < 0) {
+        perror("mmap ring");
+        exit(1);
+    }
+    return fd;
+}
+
+// 從 ring 的 pos 開始複製 len bytes，處理繞回
+static void ring_copy_out(struct ring_map *m, uint32_t pos, void *dst, size_t len)
+{
+    uint32_t size = m->ctrl->size;
+    size_t first = size - pos < len ? size - pos : len;
+
+    memcpy(dst, m->data + pos, first);
+    memcpy((char *)dst + first, m->data, len - first);
+}
+
+static void ring_copy_in(struct ring_map *m, uint32_t pos, const void *src, size_t len)
+{
+    uint32_t size = m->ctrl->size;
+    size_t first = size - pos < len ? size - pos : len;
+
+    memcpy(m->data + pos, src, first);
+    memcpy(m->data, (const char *)src + first, len - first);
+}
+
+static void *mmap_producer(void *arg)
+{
+    struct pollfd pfd = { .events = POLLOUT };
+    struct ring_map m;
+    char *payload = malloc(rec_size);
+    int i;
+
+    pfd.fd = open_mapped(&m);
+    if (!payload) {
+        perror("malloc");
+        exit(1);
+    }
+    memset(payload, 'x', rec_size);
+
+    for (i = 0; i < samples; i++) {
+        uint32_t size = m.ctrl->size;
+        uint32_t head = m.ctrl->head;
+        uint64_t ts;
+
+        // 空間不夠：先叫醒 consumer，再等它把 tail 往前推
+        while (((__atomic_load_n(&m.ctrl->tail, __ATOMIC_ACQUIRE) - head - 1) & (size - 1)) <
+               (uint32_t)rec_size) {
+            ioctl(pfd.fd, CIRC_BUF_IOC_KICK);
+            poll(&pfd, 1, POLL_TIMEOUT_MS);
+        }
+
+        ts = now_ns();
+        if (rec_size >= (int)sizeof(ts))
+            memcpy(payload, &ts, sizeof(ts));
+        ring_copy_in(&m, head, payload, rec_size);
+        __atomic_store_n(&m.ctrl->head, (head + rec_size) & (size - 1), __ATOMIC_RELEASE);
+
+        if ((i + 1) % batch == 0)
+            ioctl(pfd.fd, CIRC_BUF_IOC_KICK);
+    }
+    ioctl(pfd.fd, CIRC_BUF_IOC_KICK);
+
+    munmap(m.ctrl, m.len);
+    close(pfd.fd);
+    free(payload);
+    return NULL;
+}
+
+static void *mmap_consumer(void *arg)
+{
+    struct pollfd pfd = { .events = POLLIN };
+    struct ring_map m;
+    uint64_t recs = 0;
+
+    pfd.fd = open_mapped(&m);
+
+    while (recs < (uint64_t)samples) {
+        uint32_t size = m.ctrl->size;
+        uint32_t tail = m.ctrl->tail;
+        uint32_t head = __atomic_load_n(&m.ctrl->head, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            poll(&pfd, 1, POLL_TIMEOUT_MS);
+            continue;
+        }
+        // producer 每次只發佈完整的 record，head - tail 一定是 rec_size 的倍數
+        while (head != tail) {
+            uint64_t ts;
+
+            if (rec_size >= (int)sizeof(ts)) {
+                ring_copy_out(&m, tail, &ts, sizeof(ts));
+                record_latency(ts);
+            }
+            tail = (tail + rec_size) & (size - 1);
+            recs++;
+        }
+        __atomic_store_n(&m.ctrl->tail, tail, __ATOMIC_RELEASE);
+        ioctl(pfd.fd, CIRC_BUF_IOC_KICK);   // 叫醒等空間的 producer
+    }
+    end_ns = now_ns();
+    consumed = recs * rec_size;
+
+    munmap(m.ctrl, m.len);
+    close(pfd.fd);
+    return NULL;
+}
+
+static int run_throughput(void)
+{
+    pthread_t ptid[MAX_THREADS], ctid[MAX_THREADS];
+    uint64_t start, ns, cpu, recs;
+    int i;
+
+    lat = calloc(samples, sizeof(*lat));
+    if (!lat) {
+        perror("calloc");
+        return 1;
+    }
+
+    if (io_mode == IO_MMAP) {
+        struct ring_map m;
+        int fd = open_mapped(&m);
+        int ok = m.ctrl->head == m.ctrl->tail && (uint32_t)rec_size < m.ctrl->size;
+
+        munmap(m.ctrl, m.len);
+        close(fd);
+        if (!ok) {
+            fprintf(stderr, "mmap mode needs an empty ring larger than one record\n");
+            return 1;
+        }
+    }
+
+    start = now_ns();
+    cpu = cpu_ns();
+    if (io_mode == IO_MMAP) {
+        pthread_create(&ctid[0], NULL, mmap_consumer, NULL);
+        pthread_create(&ptid[0], NULL, mmap_producer, NULL);
+    } else {
+        for (i = 0; i < consumers; i++)
+            pthread_create(&ctid[i], NULL, rw_consumer, NULL);
+        for (i = 0; i < producers; i++)
+            pthread_create(&ptid[i], NULL, rw_producer, (void *)(intptr_t)i);
+    }
+    for (i = 0; i < producers; i++)
+        pthread_join(ptid[i], NULL);
+    for (i = 0; i < consumers; i++)
+        pthread_join(ctid[i], NULL);
+    cpu = cpu_ns() - cpu;
+    ns = end_ns - start;
+    recs = consumed / bytes_per_rec();
+
+    printf("throughput (%s, %s, %dB records, batch %d, %dP/%dC): %llu records in %.3f ms, "
+           "%.1f MB/s, %.0f records/s\n",
+           io_mode == IO_MMAP ? "mmap" : "rw", msg_mode ? "msg" : "byte", rec_size, batch,
+           producers, consumers, (unsigned long long)recs, ns / 1e6,
+           (double)recs * rec_size * 1e3 / ns, (double)recs * 1e9 / ns);
+    if (msg_mode || io_mode == IO_MMAP)
+        report("record latency", lat, lat_n < (uint64_t)samples ? lat_n : (uint64_t)samples);
+    report_cpu(cpu, ns, recs);
+    free(lat);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "LTd:n:i:ps:b:mP:C:M:")) != -1) {
+        switch (opt) {
+        case 'L': throughput = 0; break;
+        case 'T': throughput = 1; break;
+        case 'd': dev_path = optarg; break;
+        case 'n': samples = atoi(optarg); break;
+        case 'i': interval_us = atoi(optarg); break;
+        case 'p': use_poll = 1; break;
+        case 's': rec_size = atoi(optarg); break;
+        case 'b': batch = atoi(optarg); break;
+        case 'm': msg_mode = 1; break;
+        case 'P': producers = atoi(optarg); break;
+        case 'C': consumers = atoi(optarg); break;
+        case 'M':
+            if (!strcmp(optarg, "rw")) {
+                io_mode = IO_RW;
+            } else if (!strcmp(optarg, "mmap")) {
+                io_mode = IO_MMAP;
+            } else {
+                fprintf(stderr, "-M must be rw or mmap\n");
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-L|-T] [-d dev] [-n count] [-i interval_us] [-p]"
+                            " [-s size] [-b batch] [-m] [-P producers] [-C consumers]"
+                            " [-M rw|mmap]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (samples <= 0 || rec_size <= 0 || batch <= 0 || batch > MAX_BATCH) {
+        fprintf(stderr, "count and size must be > 0, batch must be 1..%d\n", MAX_BATCH);
+        return 1;
+    }
+    if (producers < 1 || producers > MAX_THREADS || consumers < 1 || consumers > MAX_THREADS) {
+        fprintf(stderr, "producers and consumers must be 1..%d\n", MAX_THREADS);
+        return 1;
+    }
+    if (io_mode == IO_MMAP && (!throughput || msg_mode || producers != 1 || consumers != 1)) {
+        fprintf(stderr, "-M mmap needs -T, byte mode and a single producer/consumer\n");
+        return 1;
+    }
+
+    return throughput ? run_throughput() : run_latency();
+}
@@ -0,0 +1,15 @@
+#ifndef _CIRC_BUF_KERNEL_H
+#define _CIRC_BUF_KERNEL_H
+
+#include <linux/types.h>
+
+// 給其他 kernel module 用的 producer API (circ_buf.ko 需以 kring_size != 0 載入)
+//
+// 把 len bytes 寫進 /dev/circ_buf<minor>，user space 照常從設備節點讀出。
+// 可以在 process / softirq / hardirq context 呼叫，不會睡；不可在 NMI 呼叫。
+// 成功回傳 len；ring 滿了回傳 -ENOSPC (資料丟棄並計入 dropped_bytes)，
+// 以 overflow=overwrite 載入時則蓋掉這顆 CPU 的 kring 上最舊的資料，不會回傳 -ENOSPC；
+// 單筆超過 ring 大小回傳 -EMSGSIZE；沒有這個 minor 或 kring 未啟用回傳 -ENODEV。
+int circ_buf_log(unsigned int minor, const void *data, size_t len);
+
+#endif // _CIRC_BUF_KERNEL_H
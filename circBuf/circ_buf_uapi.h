@@ -0,0 +1,46 @@
+#ifndef _CIRC_BUF_UAPI_H
+#define _CIRC_BUF_UAPI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// mmap 佈局：
+//   offset 0                  控制頁 (struct circ_buf_ctrl)
+//   offset ctrl->data_offset  資料區 (從第二頁開始)，大小為 ctrl->size (2 的冪次)
+//
+// 先 mmap 一頁讀出 size/data_offset，再 mmap data_offset + size 的完整範圍。
+// percpu 模式下每顆 CPU 一個 ring，第 N 個 ring 的控制頁在 N * (data_offset + size) 的 offset
+// (size 以 page 為單位向上取整)。
+// 所有 ring 之後是 kernel producer (circ_buf_log()) 的 kring，每顆 CPU 一個，排法相同，
+// 只有 user space consumer 可以 mmap 它們。
+// head/tail 都是資料區內的 byte index (0 .. size-1)。
+// user space producer：寫完資料後以 release 語意更新 head；
+// user space consumer：以 acquire 語意讀 head，讀完資料後以 release 語意更新 tail。
+// 同一側 (producer 或 consumer) 不可以同時混用 mmap 與 write()/read()。
+struct circ_buf_ctrl {
+    __u32 head;          // producer 擁有
+    __u32 pad0[15];      // head 與 tail 放在不同 cache line，避免 false sharing
+    __u32 tail;          // consumer 擁有
+    __u32 pad1[15];
+    __u32 size;          // 資料區大小 (唯讀)
+    __u32 data_offset;   // 資料區在 mmap 中的 offset (唯讀)
+};
+
+// msg_mode=1 時 ring 裡每筆 record 都是 header + payload，read() 回傳的也是這個格式：
+// 一次 read 會回傳放得下的所有完整 record，不會切斷任何一筆。
+// write() 整個 buffer 是一筆 record；writev() 的每個 iovec 各是一筆 record。
+struct circ_buf_rec {
+    __u32 len;           // payload 長度 (不含 header)
+    __u32 cpu;           // 寫入時所在的 CPU
+    __u64 ts_ns;         // 寫入時間 (CLOCK_MONOTONIC, ns)，percpu 模式的 reader 依此合併
+};
+
+// msg_mode=1 時 poll() 的 EPOLLOUT 表示至少放得下一筆 1 byte 的 record (header + 1 byte)；
+// 更長的 record 在空間不夠時仍會回傳 -EAGAIN
+#define CIRC_BUF_REC_MIN (sizeof(struct circ_buf_rec) + 1)
+
+// mmap 的一方更新 head/tail 之後，用這個 ioctl 叫醒在 read()/write()/poll() 裡等待的另一方
+#define CIRC_BUF_IOC_MAGIC 'c'
+#define CIRC_BUF_IOC_KICK  _IO(CIRC_BUF_IOC_MAGIC, 0)
+
+#endif // _CIRC_BUF_UAPI_H
@@ -0,0 +1,49 @@
+#ifndef _RBTREE_UAPI_H
+#define _RBTREE_UAPI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define RBTREE_VALUE_MAX 64          // value 最多 64 bytes (位址、路由資訊等)
+#define RBTREE_TTL_DEFAULT 0xffffffffU   // 使用模組參數 default_ttl
+
+enum {
+    RBTREE_OP_INSERT,    // 插入或更新 key，value[0..len)、ttl (秒，0 = 永不過期)
+    RBTREE_OP_DELETE,    // 刪除 key，不存在時 result = -ENOENT
+    RBTREE_OP_LOOKUP,    // 查詢 key，命中時填回 value 與 len，沒有時 result = -ENOENT
+};
+
+// 一個操作，結果寫回同一個結構的 result (0 或 -errno)
+struct rbtree_op {
+    __u32 op;
+    __s32 key;
+    __u32 ttl;
+    __u16 len;
+    __s16 result;
+    __u8 value[RBTREE_VALUE_MAX];
+};
+
+// ioctl(fd, RBTREE_IOC_BATCH, &batch)：依序執行 ops[0..count)，
+// 回傳後 done 是已執行的筆數 (被 signal 打斷時可能小於 count)
+struct rbtree_batch {
+    __u64 ops;           // struct rbtree_op 陣列的位址
+    __u32 count;
+    __u32 done;
+};
+
+// ioctl(fd, RBTREE_IOC_RANGE, &range)：依 key 由小到大回傳 lo <= key <= hi 的節點，
+// 最多 max 筆，每筆填在 ops[i] 的 key/len/value/ttl (剩餘秒數，0 表示不過期)，count 是實際筆數
+// 「key K 之後的 N 筆」就是 lo = K + 1, hi = INT32_MAX, max = N
+struct rbtree_range {
+    __s32 lo;
+    __s32 hi;
+    __u64 ops;           // struct rbtree_op 陣列的位址
+    __u32 max;
+    __u32 count;
+};
+
+#define RBTREE_IOC_MAGIC 'r'
+#define RBTREE_IOC_BATCH _IOWR(RBTREE_IOC_MAGIC, 0, struct rbtree_batch)
+#define RBTREE_IOC_RANGE _IOWR(RBTREE_IOC_MAGIC, 1, struct rbtree_range)
+
+#endif // _RBTREE_UAPI_H
@@ -1,110 +1,1281 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/rbtree.h>
+#include <linux/rbtree_latch.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/overflow.h>
+#include <linux/string.h>
+#include <linux/kstrtox.h>
+#include <linux/percpu.h>
+#include <linux/bottom_half.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/cache.h>
+#include <linux/list.h>
+#include <linux/shrinker.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/sched/signal.h>
+#include <linux/seqlock.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/random.h>
+
+#include "rbtree_uapi.h"
 
 #define PROC_NAME "rbtree"
+#define STATS_PROC_NAME "rbtree_stats"
+#define RBTREE_CMD_MAX (32 + 2 * RBTREE_VALUE_MAX)   // 指令長度，value 以 hex 表示
+#define RBTREE_POOL_MAX 256                          // 每顆 CPU 預先配置的節點數上限
+#define RBTREE_SHARDS_MAX 1024
+#define RBTREE_BATCH_CHUNK 64                        // ioctl 每次從 user space 搬進來的操作數
+#define BT_ORDER 16                                  // B+tree 每個節點的 key 數，16 個 int 剛好一條 cache line
+#define BT_MAX_HEIGHT 16
+#define INDEX_BENCH_MAX_KEYS 20000000
+#define RBTREE_REAP_BATCH 256                        // reaper 每次持有 shard->lock 最多檢查的節點數
 
 // 定義 Red-Black Tree 的節點
+// 節點建立後內容不再修改 (更新 = 換一個新節點)，reader 在 RCU 保護下讀到的一定是完整的資料
+// (唯一的例外是 referenced，reader 用它標記最近被查過)
 struct my_node {
-    struct rb_node node;
+    struct latch_tree_node lt;
+    struct rcu_head rcu;
+    struct list_head lru;    // shard 的 CLOCK 串列，受 shard->lock 保護
     int key;
+    bool referenced;         // CLOCK 的 reference bit，reader 不拿鎖直接設
+    unsigned long expires;   // 到期的 jiffies，0 表示永不過期
+    u16 len;                 // value 長度
+    u8 value[];
+};
+
+// 節點統一從專用的 kmem_cache 配置，object 大小固定為 value_size 的 value 空間
+static unsigned int value_size = 16;
+module_param(value_size, uint, 0444);
+MODULE_PARM_DESC(value_size, "Value bytes reserved per entry (1..64), larger values are rejected");
+
+static unsigned int pool_size = 64;
+module_param(pool_size, uint, 0444);
+MODULE_PARM_DESC(pool_size, "Preallocated nodes per CPU for atomic-context inserts (0..256, 0 = disable)");
+
+static struct kmem_cache *node_cache;
+
+// 每顆 CPU 一個預先配置好的節點池，softirq 裡的 insert 不用進 slab 的慢速路徑
+// 只在關 bh 的狀態下由所在的 CPU 存取，不需要鎖
+struct rbtree_pool {
+    unsigned int nr;
+    struct my_node *objs[RBTREE_POOL_MAX];
+    struct work_struct refill;
 };
+static struct rbtree_pool __percpu *pools;
+
+struct bt_node {
+    unsigned int nr;            // leaf：entry 數；internal：child 數
+    unsigned int level;         // 0 是 leaf
+    int keys[BT_ORDER];         // internal 的 keys[i] 是 child i 的下界 (keys[0] 不使用)
+    void *slots[BT_ORDER];      // leaf：struct my_node *；internal：struct bt_node *
+    struct rcu_head rcu;
+};
+
+// keyspace 依 hash 切成 nr_shards 個 shard，每個 shard 是一個獨立的索引，
+// 有自己的鎖和統計，不同 shard 的 writer 互不干擾
+//
+// 索引有兩種，載入時以 backend= 選擇：
+//
+// rbtree：每棵樹用 latch tree 的方式維護兩份：
+//   writer：持有 shard->lock，先改 tree[0] 再改 tree[1]，中間以 seqcount 切換 reader 看的那份
+//   reader：rcu_read_lock() 下走 seqcount 指定的那份，seqcount 變了就重來，完全不拿鎖
+//
+// btree：B+tree，每個節點放 BT_ORDER 個 key，查詢時每層只碰一兩條 cache line，
+// 樹高約 log8(N)，比 rbtree 每層一個指標少很多次 cache miss。
+//   writer：持有 shard->lock，修改包在 bt_seq 的 write section 裡；拿掉的 B+tree 節點用 kfree_rcu()
+//   reader：rcu_read_lock() 下走訪，bt_seq 變了就重來。寫入中途看到的可能是不一致的節點，
+//           但所有指標都指向還沒過 grace period 的記憶體，只要不越界、不走錯層就安全
+//   已經持有 shard->lock 的 writer 不需要也不能碰 bt_seq (PREEMPT_RT 上 reader 端會去拿 lock)，
+//   直接走訪
+//
+// 被刪掉的節點用 call_rcu() 延後回收，reader 手上的指標在 grace period 前都還有效
+// 會在 softirq 中插入，所以 process context 一律用 spin_lock_bh()
+//
+// 每個 shard 另有一條 CLOCK (second chance) 串列：新節點放尾巴，要淘汰時從頭拿，
+// 被查過的 (referenced) 清掉標記移到尾巴再給一次機會，沒被查過的就淘汰。
+// reader 只要設一個 bit，不需要像 LRU 那樣在查詢時拿鎖搬動串列。
+struct rbtree_shard {
+    spinlock_t lock;
+    bool btree;
+    struct latch_tree_root tree;
+    struct bt_node __rcu *bt_root;
+    seqcount_spinlock_t bt_seq;
+    struct list_head lru;
+    struct list_head reap_cursor;   // reaper 分段走訪時停在 lru 裡的位置，不是節點
+    unsigned long nr_entries;   // 受 lock 保護
+    unsigned long bt_nodes;     // B+tree 節點數，受 lock 保護，算在 max_bytes 裡
+} ____cacheline_aligned_in_smp;
+
+static unsigned int nr_shards = 16;
+module_param(nr_shards, uint, 0444);
+MODULE_PARM_DESC(nr_shards, "Number of independent tree shards (power of two, 1..1024)");
+
+static struct rbtree_shard *shards;
+
+enum { BACKEND_RBTREE, BACKEND_BTREE };
+static const char * const backend_names[] = { "rbtree", "btree" };
+
+static char *backend = "rbtree";
+module_param(backend, charp, 0444);
+MODULE_PARM_DESC(backend, "Index backend: rbtree (latched red-black tree) or btree (B+tree)");
+
+static int backend_type;   // init 時由 backend 字串解析
+
+// 統計放在 per-CPU 變數裡，熱路徑上只有一個 this_cpu_inc()，不碰共用的 cache line；
+// 讀 /proc/rbtree_stats 時才把每顆 CPU 的加起來
+// 延遲直方圖 (統計和 benchmark 共用) 以 log2(ns) 分桶：第 k 桶是 [2^k, 2^(k+1)) ns，最後一桶包含更長的
+#define RBTREE_LAT_BUCKETS 32
+
+enum rbtree_stat {
+    STAT_HITS,
+    STAT_MISSES,
+    STAT_INSERTS,
+    STAT_DUP_INSERTS,   // key 已存在，取代舊值 (也算在 inserts 裡)
+    STAT_DELETES,
+    STAT_EVICTIONS,
+    STAT_EXPIRED,       // lookup 時順便刪掉或被 reaper 清掉的過期節點
+    NR_STATS
+};
+static const char * const stat_names[] = {
+    "hits", "misses", "inserts", "dup_inserts", "deletes", "evictions", "expired",
+};
+
+enum { LAT_LOOKUP, LAT_INSERT, NR_LAT };
+static const char * const lat_names[] = { "lookup", "insert" };
+
+struct rbtree_cpu_stats {
+    unsigned long count[NR_STATS];
+    unsigned long lat[NR_LAT][RBTREE_LAT_BUCKETS];
+};
+static DEFINE_PER_CPU(struct rbtree_cpu_stats, rbtree_stats);
+
+#define rbtree_stat_inc(s) this_cpu_inc(rbtree_stats.count[s])
+
+// 計時要讀兩次 clock，預設關閉；需要時再從 sysfs 打開
+static bool latency_stats;
+module_param(latency_stats, bool, 0644);
+MODULE_PARM_DESC(latency_stats, "Record lookup/insert latency histograms in /proc/rbtree_stats");
+
+static unsigned int rbtree_lat_bucket(u64 ns)
+{
+    return min_t(unsigned int, ilog2(ns | 1), RBTREE_LAT_BUCKETS - 1);
+}
+
+// 印出一個直方圖，空的桶略過
+static void rbtree_lat_show(struct seq_file *m, const unsigned long *buckets)
+{
+    unsigned int k;
+
+    for (k = 0; k < RBTREE_LAT_BUCKETS; k++) {
+        if (buckets[k])
+            seq_printf(m, "  %12llu ns: %lu\n", 1ULL << k, buckets[k]);
+    }
+}
+
+static void rbtree_lat_add(int which, u64 ns)
+{
+    this_cpu_inc(rbtree_stats.lat[which][rbtree_lat_bucket(ns)]);
+}
+
+// 上限平均分給每個 shard，淘汰只看自己的 shard，不需要全域的鎖或計數
+static unsigned long max_entries;
+module_param(max_entries, ulong, 0644);
+MODULE_PARM_DESC(max_entries, "Maximum cached entries (0 = unlimited)");
+
+static unsigned long max_bytes;
+module_param(max_bytes, ulong, 0644);
+MODULE_PARM_DESC(max_bytes, "Maximum memory used by cached entries and B+tree nodes in bytes (0 = unlimited)");
+
+static struct shrinker *rbtree_shrinker;
+
+#define lt_to_node(n) container_of(n, struct my_node, lt)
+#define rb_to_node(n, idx) container_of(n, struct my_node, lt.node[idx])
+
+static unsigned int default_ttl = 300;
+module_param(default_ttl, uint, 0644);
+MODULE_PARM_DESC(default_ttl, "Default entry lifetime in seconds (0 = never expire)");
+
+static unsigned int reap_interval = 10;
+module_param(reap_interval, uint, 0444);
+MODULE_PARM_DESC(reap_interval, "Seconds between expired-entry sweeps (0 = only expire lazily on lookup)");
+
+// 每個 shard 最多能放幾個節點 (max_entries)，0 表示不限制
+static unsigned long rbtree_shard_cap(void)
+{
+    unsigned long cap = READ_ONCE(max_entries);
+
+    return cap ? DIV_ROUND_UP(cap, nr_shards) : 0;
+}
+
+// 每個 shard 可用的記憶體 (max_bytes)，entry 與 B+tree 節點一起算，0 表示不限制
+static unsigned long rbtree_shard_bytes(void)
+{
+    unsigned long bytes = READ_ONCE(max_bytes);
+
+    return bytes ? max(bytes / nr_shards, 1UL) : 0;
+}
+
+// B+tree 節點實際佔用的記憶體 (kzalloc 會進位到 kmalloc 的 size class)
+static size_t bt_node_bytes(void)
+{
+    return kmalloc_size_roundup(sizeof(struct bt_node));
+}
+
+// 再放一個新節點會不會超過上限，需要先淘汰 (需持有 shard->lock)
+// 至少留一個 entry 的位置，max_bytes 設得比一個 entry 還小時仍然可以插入
+static bool rbtree_shard_full(struct rbtree_shard *sh)
+{
+    unsigned long cap = rbtree_shard_cap();
+    unsigned long bytes = rbtree_shard_bytes();
+
+    if (cap && sh->nr_entries >= cap)
+        return true;
+    return bytes && sh->nr_entries &&
+           (sh->nr_entries + 1) * kmem_cache_size(node_cache) + sh->bt_nodes * bt_node_bytes() > bytes;
+}
+
+static struct rbtree_shard *rbtree_shard(int key)
+{
+    // hash_32() 的 bits 不能是 0
+    return nr_shards > 1 ? &shards[hash_32((u32)key, ilog2(nr_shards))] : &shards[0];
+}
+
+static void rbtree_reap_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(rbtree_reap_work, rbtree_reap_fn);
+
+// 補滿目前 CPU 的節點池 (process context)
+static void rbtree_pool_refill(struct work_struct *work)
+{
+    struct rbtree_pool *pool;
+    struct my_node *data;
+
+    for (;;) {
+        data = kmem_cache_alloc(node_cache, GFP_KERNEL);
+        if (!data)
+            return;
+
+        local_bh_disable();
+        pool = this_cpu_ptr(pools);
+        if (pool->nr < pool_size) {
+            pool->objs[pool->nr++] = data;
+            data = NULL;
+        }
+        local_bh_enable();
+
+        if (data) {
+            kmem_cache_free(node_cache, data);
+            return;
+        }
+    }
+}
+
+// 配置節點：先拿本地 CPU 的節點池，空了才進 slab
+// 不論 gfp 能不能睡，池子低於一半就排 work 回 process context 補；
+// process context 的 insert 也會拿池子，只在 atomic 時補的話池子會被它們慢慢用光
+static struct my_node *rbtree_node_alloc(gfp_t gfp)
+{
+    struct rbtree_pool *pool;
+    struct my_node *data = NULL;
+
+    local_bh_disable();
+    pool = this_cpu_ptr(pools);
+    if (pool->nr)
+        data = pool->objs[--pool->nr];
+    if (pool->nr < pool_size / 2)
+        schedule_work_on(smp_processor_id(), &pool->refill);
+    local_bh_enable();
+
+    return data ?: kmem_cache_alloc(node_cache, gfp);
+}
+
+// 節點還回本地 CPU 的節點池，池子滿了才還給 slab
+static void rbtree_node_free(struct my_node *data)
+{
+    struct rbtree_pool *pool;
+
+    local_bh_disable();
+    pool = this_cpu_ptr(pools);
+    if (pool->nr < pool_size) {
+        pool->objs[pool->nr++] = data;
+        data = NULL;
+    }
+    local_bh_enable();
+
+    if (data)
+        kmem_cache_free(node_cache, data);
+}
+
+// grace period 過後 reader 都已經放手，節點可以重新使用
+static void rbtree_node_free_rcu(struct rcu_head *rcu)
+{
+    rbtree_node_free(container_of(rcu, struct my_node, rcu));
+}
+
+static bool rbtree_expired(const struct my_node *data)
+{
+    return data->expires && time_after_eq(jiffies, data->expires);
+}
+
+static __always_inline bool rbtree_less(struct latch_tree_node *a, struct latch_tree_node *b)
+{
+    return lt_to_node(a)->key < lt_to_node(b)->key;
+}
+
+static __always_inline int rbtree_comp(void *key, struct latch_tree_node *n)
+{
+    int k = *(int *)key;
+
+    if (k < lt_to_node(n)->key)
+        return -1;
+    return k > lt_to_node(n)->key;
+}
+
+static const struct latch_tree_ops rbtree_latch_ops = {
+    .less = rbtree_less,
+    .comp = rbtree_comp,
+};
+
+static struct my_node *latch_search(struct rbtree_shard *sh, int key)
+{
+    struct latch_tree_node *n = latch_tree_find(&key, &sh->tree, &rbtree_latch_ops);
+
+    return n ? lt_to_node(n) : NULL;
+}
+
+static struct my_node *latch_ceil(struct rbtree_shard *sh, int key)
+{
+    struct my_node *data, *best;
+    struct rb_node *node;
+    unsigned int seq;
+
+    do {
+        seq = raw_read_seqcount_latch(&sh->tree.seq);
+        node = rcu_dereference_raw(sh->tree.tree[seq & 1].rb_node);
+        best = NULL;
+        while (node) {
+            data = rb_to_node(node, seq & 1);
+            if (key <= data->key) {
+                best = data;
+                if (key == data->key)
+                    break;
+                node = rcu_dereference_raw(node->rb_left);
+            } else {
+                node = rcu_dereference_raw(node->rb_right);
+            }
+        }
+    } while (raw_read_seqcount_latch_retry(&sh->tree.seq, seq));
+
+    return best;
+}
+
+/* ---------------- B+tree ---------------- */
+
+// reader 可能讀到寫到一半的 nr，先夾在陣列範圍內
+static unsigned int bt_nr(const struct bt_node *n)
+{
+    return min_t(unsigned int, READ_ONCE(n->nr), BT_ORDER);
+}
+
+// internal 節點：最後一個 keys[i] <= key 的 child (keys[0] 視為負無限大)
+static unsigned int bt_child_idx(const struct bt_node *n, int key, unsigned int nr)
+{
+    unsigned int lo = 1, hi = nr, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (READ_ONCE(n->keys[mid]) <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+// leaf 節點：第一個 keys[i] >= key 的位置
+static unsigned int bt_lower_bound(const struct bt_node *n, int key, unsigned int nr)
+{
+    unsigned int lo = 0, hi = nr, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (READ_ONCE(n->keys[mid]) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// 往下走一層；讀到不一致的節點 (寫入中途) 時回傳 NULL，交給 seqcount 重來
+static struct bt_node *bt_child(const struct bt_node *n, unsigned int idx)
+{
+    struct bt_node *child = READ_ONCE(n->slots[idx]);
+
+    if (!child || READ_ONCE(child->level) + 1 != READ_ONCE(n->level))
+        return NULL;
+    return child;
+}
+
+static struct bt_node *bt_root(struct rbtree_shard *sh)
+{
+    return rcu_dereference_check(sh->bt_root, lockdep_is_held(&sh->lock));
+}
+
+static struct my_node *__bt_search(struct bt_node *n, int key)
+{
+    unsigned int nr, i;
+
+    while (n && (nr = bt_nr(n))) {
+        if (!READ_ONCE(n->level)) {
+            i = bt_lower_bound(n, key, nr);
+            if (i < nr && READ_ONCE(n->keys[i]) == key)
+                return READ_ONCE(n->slots[i]);
+            return NULL;
+        }
+        n = bt_child(n, bt_child_idx(n, key, nr));
+    }
+    return NULL;
+}
+
+// 以下兩個是 reader 用的 (rcu_read_lock() 內，不持有 shard->lock)
+static struct my_node *bt_search(struct rbtree_shard *sh, int key)
+{
+    struct my_node *data;
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&sh->bt_seq);
+        data = __bt_search(bt_root(sh), key);
+    } while (read_seqcount_retry(&sh->bt_seq, seq));
+    return data;
+}
+
+// 沒有 leaf 之間的鏈結 (RCU 下不好維護)，往下找不到就回到上一層試下一個 child；
+// 空節點會被拿掉，所以下一個 child 的第一個 entry 就是答案，仍然是 O(樹高)
+static struct my_node *__bt_ceil(struct bt_node *n, int key, unsigned int depth)
+{
+    struct my_node *data;
+    struct bt_node *child;
+    unsigned int nr = bt_nr(n), i;
+
+    if (!nr || depth > BT_MAX_HEIGHT)
+        return NULL;
+    if (!READ_ONCE(n->level)) {
+        i = bt_lower_bound(n, key, nr);
+        return i < nr ? READ_ONCE(n->slots[i]) : NULL;
+    }
+    for (i = bt_child_idx(n, key, nr); i < nr; i++) {
+        child = bt_child(n, i);
+        if (!child)
+            return NULL;
+        data = __bt_ceil(child, key, depth + 1);
+        if (data)
+            return data;
+    }
+    return NULL;
+}
+
+static struct my_node *bt_ceil(struct rbtree_shard *sh, int key)
+{
+    struct my_node *data;
+    struct bt_node *root;
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&sh->bt_seq);
+        root = bt_root(sh);
+        data = root ? __bt_ceil(root, key, 0) : NULL;
+    } while (read_seqcount_retry(&sh->bt_seq, seq));
+    return data;
+}
+
+// 以下 writer 函式都在 shard->lock 與 bt_seq 的 write section 內呼叫
+// 會被 reader 同時讀到的欄位一律用 WRITE_ONCE()，新節點填好後才用 release 語意掛上去
+
+static struct bt_node *bt_alloc(struct rbtree_shard *sh, unsigned int level)
+{
+    struct bt_node *n = kzalloc(sizeof(*n), GFP_ATOMIC | __GFP_NOWARN);
+
+    if (n) {
+        n->level = level;
+        sh->bt_nodes++;
+    }
+    return n;
+}
+
+// 拿掉已經掛上去過的節點，reader 可能還在看，等 grace period 後才釋放
+static void bt_free(struct rbtree_shard *sh, struct bt_node *n)
+{
+    sh->bt_nodes--;
+    kfree_rcu(n, rcu);
+}
+
+// 在 idx 插入一組 key/slot (節點未滿)
+static void bt_insert_at(struct bt_node *n, unsigned int idx, int key, void *slot)
+{
+    unsigned int i;
+
+    for (i = n->nr; i > idx; i--) {
+        WRITE_ONCE(n->keys[i], n->keys[i - 1]);
+        WRITE_ONCE(n->slots[i], n->slots[i - 1]);
+    }
+    WRITE_ONCE(n->keys[idx], key);
+    smp_store_release(&n->slots[idx], slot);
+    WRITE_ONCE(n->nr, n->nr + 1);
+}
+
+// 移除 idx，空出來的 slot 清成 NULL，reader 不會拿到已經釋放的舊指標
+static void bt_remove_at(struct bt_node *n, unsigned int idx)
+{
+    unsigned int i;
+
+    for (i = idx; i + 1 < n->nr; i++) {
+        WRITE_ONCE(n->keys[i], n->keys[i + 1]);
+        WRITE_ONCE(n->slots[i], n->slots[i + 1]);
+    }
+    WRITE_ONCE(n->nr, n->nr - 1);
+    WRITE_ONCE(n->slots[n->nr], NULL);
+}
+
+// 把 parent 的第 idx 個 child (已滿) 從中間切開，右半邊掛在 idx + 1
+static int bt_split(struct rbtree_shard *sh, struct bt_node *parent, unsigned int idx)
+{
+    struct bt_node *child = parent->slots[idx], *right;
+    unsigned int half = BT_ORDER / 2, i;
+
+    right = bt_alloc(sh, child->level);
+    if (!right)
+        return -ENOMEM;
+    for (i = half; i < BT_ORDER; i++) {
+        right->keys[i - half] = child->keys[i];
+        right->slots[i - half] = child->slots[i];
+    }
+    right->nr = BT_ORDER - half;
+
+    bt_insert_at(parent, idx + 1, right->keys[0], right);
+    WRITE_ONCE(child->nr, half);
+    for (i = half; i < BT_ORDER; i++)
+        WRITE_ONCE(child->slots[i], NULL);
+    return 0;
+}
+
+// 由上往下插入，路上遇到滿的節點先切開，到 leaf 時一定有空位 (key 必須不存在)
+static int bt_insert(struct rbtree_shard *sh, struct my_node *data)
+{
+    struct bt_node *root = bt_root(sh), *n, *top;
+    int key = data->key;
+    unsigned int i;
+
+    if (!root) {
+        root = bt_alloc(sh, 0);
+        if (!root)
+            return -ENOMEM;
+        bt_insert_at(root, 0, key, data);
+        rcu_assign_pointer(sh->bt_root, root);
+        return 0;
+    }
+    if (root->nr == BT_ORDER) {
+        if (root->level + 1 >= BT_MAX_HEIGHT)
+            return -ENOSPC;
+        top = bt_alloc(sh, root->level + 1);
+        if (!top)
+            return -ENOMEM;
+        bt_insert_at(top, 0, root->keys[0], root);
+        if (bt_split(sh, top, 0)) {
+            sh->bt_nodes--;
+            kfree(top);   // 還沒掛上去，沒有 reader 看過
+            return -ENOMEM;
+        }
+        rcu_assign_pointer(sh->bt_root, top);
+        root = top;
+    }
+
+    for (n = root; n->level; n = n->slots[i]) {
+        i = bt_child_idx(n, key, n->nr);
+        if (((struct bt_node *)n->slots[i])->nr == BT_ORDER) {
+            if (bt_split(sh, n, i))
+                return -ENOMEM;
+            if (key >= n->keys[i + 1])
+                i++;
+        }
+    }
+    bt_insert_at(n, bt_lower_bound(n, key, n->nr), key, data);
+    return 0;
+}
+
+// 找到 data 所在的 leaf，沿路記下每一層的節點與位置
+static int bt_path(struct rbtree_shard *sh, struct my_node *data,
+                   struct bt_node **path, unsigned int *idx)
+{
+    struct bt_node *n = bt_root(sh);
+    int depth = 0;
+
+    while (n) {
+        path[depth] = n;
+        if (!n->level) {
+            idx[depth] = bt_lower_bound(n, data->key, n->nr);
+            if (idx[depth] >= n->nr || n->slots[idx[depth]] != data)
+                return -1;
+            return depth;
+        }
+        idx[depth] = bt_child_idx(n, data->key, n->nr);
+        n = n->slots[idx[depth++]];
+    }
+    return -1;
+}
+
+// 刪除時不做合併，只把變空的節點拿掉；root 只剩一個 child 時樹高降一層
+static void bt_erase(struct rbtree_shard *sh, struct my_node *data)
+{
+    struct bt_node *path[BT_MAX_HEIGHT], *root;
+    unsigned int idx[BT_MAX_HEIGHT];
+    int depth = bt_path(sh, data, path, idx);
+
+    if (WARN_ON_ONCE(depth < 0))
+        return;
+    for (; depth >= 0; depth--) {
+        bt_remove_at(path[depth], idx[depth]);
+        if (path[depth]->nr || !depth)
+            break;
+        bt_free(sh, path[depth]);
+    }
+
+    while ((root = bt_root(sh)) && root->level && root->nr == 1) {
+        rcu_assign_pointer(sh->bt_root, root->slots[0]);
+        bt_free(sh, root);
+    }
+    if (root && !root->nr) {
+        RCU_INIT_POINTER(sh->bt_root, NULL);
+        bt_free(sh, root);
+    }
+}
+
+static void bt_replace(struct rbtree_shard *sh, struct my_node *old, struct my_node *new)
+{
+    struct bt_node *path[BT_MAX_HEIGHT];
+    unsigned int idx[BT_MAX_HEIGHT];
+    int depth = bt_path(sh, old, path, idx);
+
+    if (!WARN_ON_ONCE(depth < 0))
+        smp_store_release(&path[depth]->slots[idx[depth]], new);
+}
+
+// 卸載或 benchmark 結束時釋放所有 B+tree 節點 (entry 由呼叫者另外釋放，已沒有 reader)
+static void bt_destroy(struct bt_node *n)
+{
+    unsigned int i;
+
+    if (!n)
+        return;
+    for (i = 0; n->level && i < n->nr; i++)
+        bt_destroy(n->slots[i]);
+    kfree(n);
+}
+
+/* ---------------- 索引介面 ---------------- */
+
+// 在 shard 裡找到 key 對應的節點 (rcu_read_lock() 內，不持有 shard->lock)
+static struct my_node *rbtree_search(struct rbtree_shard *sh, int key)
+{
+    return sh->btree ? bt_search(sh, key) : latch_search(sh, key);
+}
+
+// 同上，給已經持有 shard->lock 的 writer 用：樹不會變動，B+tree 直接走訪，不經過 bt_seq
+static struct my_node *rbtree_search_locked(struct rbtree_shard *sh, int key)
+{
+    lockdep_assert_held(&sh->lock);
+    return sh->btree ? __bt_search(bt_root(sh), key) : latch_search(sh, key);
+}
+
+// 在 shard 裡找到第一個 key >= 參數的節點 (rcu_read_lock() 內)
+// 依序走訪整棵樹時用：每次從上一個 key + 1 往下找，不需要持有 rb_next() 需要的鎖
+static struct my_node *rbtree_ceil(struct rbtree_shard *sh, int key)
+{
+    return sh->btree ? bt_ceil(sh, key) : latch_ceil(sh, key);
+}
+
+// 以下需持有 shard->lock
+static int rbtree_index_insert(struct rbtree_shard *sh, struct my_node *data)
+{
+    int ret;
+
+    if (!sh->btree) {
+        latch_tree_insert(&data->lt, &sh->tree, &rbtree_latch_ops);
+        return 0;
+    }
+    write_seqcount_begin(&sh->bt_seq);
+    ret = bt_insert(sh, data);
+    write_seqcount_end(&sh->bt_seq);
+    return ret;
+}
+
+static void rbtree_index_erase(struct rbtree_shard *sh, struct my_node *data)
+{
+    if (!sh->btree) {
+        latch_tree_erase(&data->lt, &sh->tree, &rbtree_latch_ops);
+        return;
+    }
+    write_seqcount_begin(&sh->bt_seq);
+    bt_erase(sh, data);
+    write_seqcount_end(&sh->bt_seq);
+}
+
+// 原地換掉同一個 key 的節點；只換一個指標，reader 不會有一瞬間查不到這個 key
+static void rbtree_index_replace(struct rbtree_shard *sh, struct my_node *old, struct my_node *new)
+{
+    if (sh->btree) {
+        bt_replace(sh, old, new);
+        return;
+    }
+    // latch tree 的兩份都換掉；rb_replace_node_rcu() 本身對 reader 就是安全的，不需要 latch 切換
+    rb_replace_node_rcu(&old->lt.node[0], &new->lt.node[0], &sh->tree.tree[0]);
+    rb_replace_node_rcu(&old->lt.node[1], &new->lt.node[1], &sh->tree.tree[1]);
+}
+
+static void rbtree_shard_init(struct rbtree_shard *sh, bool btree)
+{
+    spin_lock_init(&sh->lock);
+    sh->btree = btree;
+    seqcount_latch_init(&sh->tree.seq);
+    seqcount_spinlock_init(&sh->bt_seq, &sh->lock);
+    INIT_LIST_HEAD(&sh->lru);
+}
+
+// 依 key 由小到大走訪所有 shard：每個 shard 留一個游標 (該 shard 下一個節點)，
+// 每次輸出最小的那個，再把那個 shard 的游標往後推，等於 nr_shards 路的 merge
+// 游標只在同一個 rcu_read_lock() 區間內有效
+struct rbtree_iter {
+    struct my_node **cur;
+};
+
+static int rbtree_iter_init(struct rbtree_iter *it)
+{
+    it->cur = kmalloc_array(nr_shards, sizeof(*it->cur), GFP_KERNEL);
+    return it->cur ? 0 : -ENOMEM;
+}
+
+static void rbtree_iter_destroy(struct rbtree_iter *it)
+{
+    kfree(it->cur);
+}
+
+// 把游標定位到第一個 key >= 參數的節點
+static void rbtree_iter_seek(struct rbtree_iter *it, int key)
+{
+    unsigned int i;
+
+    for (i = 0; i < nr_shards; i++)
+        it->cur[i] = rbtree_ceil(&shards[i], key);
+}
+
+static struct my_node *rbtree_iter_next(struct rbtree_iter *it)
+{
+    struct my_node *data = NULL;
+    unsigned int i, min = 0;
+
+    for (i = 0; i < nr_shards; i++) {
+        if (it->cur[i] && (!data || it->cur[i]->key < data->key)) {
+            data = it->cur[i];
+            min = i;
+        }
+    }
+    if (data)
+        it->cur[min] = data->key == INT_MAX ? NULL : rbtree_ceil(&shards[min], data->key + 1);
+    return data;
+}
+
+// 下一個還沒過期、key 不超過 hi 的節點
+static struct my_node *rbtree_iter_next_live(struct rbtree_iter *it, int hi)
+{
+    struct my_node *data;
+
+    while ((data = rbtree_iter_next(it)) && data->key <= hi) {
+        if (!rbtree_expired(data))
+            return data;
+    }
+    return NULL;
+}
+
+// 把節點從 shard 拿掉，之後由呼叫者用 call_rcu() 回收 (需持有 shard->lock)
+static void rbtree_unlink(struct rbtree_shard *sh, struct my_node *data)
+{
+    rbtree_index_erase(sh, data);
+    list_del(&data->lru);
+    sh->nr_entries--;
+}
+
+// CLOCK 串列的第一個節點，跳過 reaper 的 cursor (需持有 shard->lock)
+static struct my_node *rbtree_lru_first(struct rbtree_shard *sh)
+{
+    struct list_head *p = sh->lru.next;
+
+    if (p == &sh->reap_cursor)
+        p = p->next;
+    return p == &sh->lru ? NULL : list_entry(p, struct my_node, lru);
+}
+
+// CLOCK 淘汰一個節點 (需持有 shard->lock)
+// reader 可能一直在設 reference bit，最多繞兩圈，之後不管標記直接淘汰頭上的
+static bool rbtree_evict_one(struct rbtree_shard *sh)
+{
+    unsigned long scan = 2 * sh->nr_entries;
+    struct my_node *data;
+
+    while ((data = rbtree_lru_first(sh))) {
+        if (scan-- && READ_ONCE(data->referenced) && !rbtree_expired(data)) {
+            WRITE_ONCE(data->referenced, false);
+            list_move_tail(&data->lru, &sh->lru);
+            continue;
+        }
+        rbtree_unlink(sh, data);
+        call_rcu(&data->rcu, rbtree_node_free_rcu);
+        rbtree_stat_inc(STAT_EVICTIONS);
+        return true;
+    }
+    return false;
+}
+
+static int __rbtree_insert(int key, const void *value, size_t len, unsigned int ttl, gfp_t gfp)
+{
+    struct rbtree_shard *sh = rbtree_shard(key);
+    struct my_node *data, *old;
+    int ret = 0;
+
+    if (len > value_size)
+        return -EMSGSIZE;
+
+    // 先在鎖外配置好節點，持有 spinlock 時不能睡
+    data = rbtree_node_alloc(gfp);
+    if (!data)
+        return -ENOMEM;
+
+    data->key = key;
+    data->referenced = false;
+    data->len = len;
+    data->expires = ttl ? (jiffies + (unsigned long)ttl * HZ) ?: 1 : 0;
+    memcpy(data->value, value, len);
+
+    spin_lock_bh(&sh->lock);
+    old = rbtree_search_locked(sh, key);
+    if (old) {
+        // Key 已存在，原地換掉；reference bit 和其他欄位一樣在發布給 reader 之前設好
+        data->referenced = READ_ONCE(old->referenced);
+        rbtree_index_replace(sh, old, data);
+        list_replace(&old->lru, &data->lru);
+        rbtree_stat_inc(STAT_DUP_INSERTS);
+    } else {
+        // 先騰出空間再放新節點，新節點不會馬上被自己擠掉
+        while (rbtree_shard_full(sh) && rbtree_evict_one(sh))
+            ;
+        ret = rbtree_index_insert(sh, data);
+        if (!ret) {
+            list_add_tail(&data->lru, &sh->lru);
+            sh->nr_entries++;
+        }
+    }
+    if (!ret)
+        rbtree_stat_inc(STAT_INSERTS);
+    spin_unlock_bh(&sh->lock);
+
+    if (ret)
+        rbtree_node_free(data);   // 沒掛上去，沒有 reader 看過
+    if (old)
+        call_rcu(&old->rcu, rbtree_node_free_rcu);
+    return ret;
+}
+
+// 插入節點，key 已存在時以新的 value/TTL 取代
+// ttl 以秒為單位，0 表示永不過期
+// softirq 等 atomic context 傳 GFP_ATOMIC，會優先用本地 CPU 的節點池
+static int rbtree_insert(int key, const void *value, size_t len, unsigned int ttl, gfp_t gfp)
+{
+    u64 start;
+    int ret;
+
+    if (!READ_ONCE(latency_stats))
+        return __rbtree_insert(key, value, len, ttl, gfp);
+    start = ktime_get_ns();
+    ret = __rbtree_insert(key, value, len, ttl, gfp);
+    rbtree_lat_add(LAT_INSERT, ktime_get_ns() - start);
+    return ret;
+}
+
+// 刪除節點
+static int rbtree_delete(int key)
+{
+    struct rbtree_shard *sh = rbtree_shard(key);
+    struct my_node *data;
+
+    spin_lock_bh(&sh->lock);
+    data = rbtree_search_locked(sh, key);
+    if (data) {
+        rbtree_unlink(sh, data);
+        rbtree_stat_inc(STAT_DELETES);
+    }
+    spin_unlock_bh(&sh->lock);
+
+    if (!data)
+        return 0;  // 找不到 key
+    call_rcu(&data->rcu, rbtree_node_free_rcu);
+    return 1;  // 成功刪除
+}
+
+// 刪掉已過期的節點；拿到鎖時它可能已經被換掉或刪掉，要再確認一次
+static void rbtree_expire(struct rbtree_shard *sh, struct my_node *data)
+{
+    struct my_node *cur;
+
+    spin_lock_bh(&sh->lock);
+    cur = rbtree_search_locked(sh, data->key);
+    if (cur != data) {
+        cur = NULL;
+    } else {
+        rbtree_unlink(sh, data);
+        rbtree_stat_inc(STAT_EXPIRED);
+    }
+    spin_unlock_bh(&sh->lock);
+
+    if (cur)
+        call_rcu(&cur->rcu, rbtree_node_free_rcu);
+}
+
+static int __rbtree_lookup(int key, void *buf, size_t size)
+{
+    struct rbtree_shard *sh = rbtree_shard(key);
+    struct my_node *data;
+    int ret = -ENOENT;
+
+    rcu_read_lock();
+    data = rbtree_search(sh, key);
+    if (data && rbtree_expired(data)) {
+        rbtree_expire(sh, data);
+    } else if (data) {
+        // 已經設過就不要再寫，避免熱門節點的 cache line 在 CPU 間來回
+        if (!READ_ONCE(data->referenced))
+            WRITE_ONCE(data->referenced, true);
+        memcpy(buf, data->value, min_t(size_t, size, data->len));
+        ret = data->len;
+    }
+    rcu_read_unlock();
+
+    rbtree_stat_inc(ret < 0 ? STAT_MISSES : STAT_HITS);
+    return ret;
+}
+
+// 查詢：把 value 複製到 buf (最多 size bytes)，回傳 value 長度
+// 找不到或已過期回傳 -ENOENT，過期的節點順便刪掉 (lazy expiry)
+// 命中時完全不拿鎖，只有遇到過期節點才會去拿 shard->lock
+static int rbtree_lookup(int key, void *buf, size_t size)
+{
+    u64 start;
+    int ret;
+
+    if (!READ_ONCE(latency_stats))
+        return __rbtree_lookup(key, buf, size);
+    start = ktime_get_ns();
+    ret = __rbtree_lookup(key, buf, size);
+    rbtree_lat_add(LAT_LOOKUP, ktime_get_ns() - start);
+    return ret;
+}
+
+// 定期清掉過期節點，避免沒人查詢的 key 一直佔著記憶體
+static void rbtree_reap_fn(struct work_struct *work)
+{
+    struct rbtree_shard *sh;
+    struct list_head *next;
+    struct my_node *data;
+    unsigned int i, n, reaped = 0;
+
+    // 走 CLOCK 串列而不是索引，兩種 backend 都一樣
+    // 每次持有 shard->lock 最多檢查 RBTREE_REAP_BATCH 個節點就放開鎖，大 shard 也不會長時間
+    // 關 bh 擋住 writer；放開鎖期間節點可能被刪掉或搬動，所以用一個掛在串列裡的 cursor 記住位置
+    for (i = 0; i < nr_shards; i++) {
+        sh = &shards[i];
+        spin_lock_bh(&sh->lock);
+        list_add(&sh->reap_cursor, &sh->lru);
+        for (;;) {
+            for (n = 0; n < RBTREE_REAP_BATCH; n++) {
+                next = sh->reap_cursor.next;
+                if (next == &sh->lru)
+                    break;
+                data = list_entry(next, struct my_node, lru);
+                list_move(&sh->reap_cursor, next);   // cursor 移到 data 後面
+                if (!rbtree_expired(data))
+                    continue;
+                rbtree_unlink(sh, data);
+                call_rcu(&data->rcu, rbtree_node_free_rcu);
+                rbtree_stat_inc(STAT_EXPIRED);
+                reaped++;
+            }
+            if (sh->reap_cursor.next == &sh->lru)
+                break;
+            spin_unlock_bh(&sh->lock);
+            cond_resched();
+            spin_lock_bh(&sh->lock);
+        }
+        list_del(&sh->reap_cursor);
+        spin_unlock_bh(&sh->lock);
+        cond_resched();
+    }
+
+    if (reaped)
+        pr_info("rbtree: reaped %u expired entries\n", reaped);
+    if (reap_interval)
+        schedule_delayed_work(&rbtree_reap_work, reap_interval * HZ);
+}
+
+// 釋放所有節點 (卸載時已沒有 reader)
+static void rbtree_free(void)
+{
+    struct rbtree_shard *sh;
+    struct my_node *data, *next;
+    unsigned int i;
+
+    for (i = 0; i < nr_shards; i++) {
+        sh = &shards[i];
+        list_for_each_entry_safe(data, next, &sh->lru, lru) {
+            if (!sh->btree)
+                latch_tree_erase(&data->lt, &sh->tree, &rbtree_latch_ops);
+            kmem_cache_free(node_cache, data);
+        }
+        bt_destroy(rcu_dereference_protected(sh->bt_root, 1));
+        RCU_INIT_POINTER(sh->bt_root, NULL);
+        INIT_LIST_HEAD(&sh->lru);
+        sh->nr_entries = 0;
+        sh->bt_nodes = 0;
+    }
+}
+
+// 記憶體吃緊時讓 kernel 回收快取：count 回報可回收的節點數，scan 依 CLOCK 淘汰
+static unsigned long rbtree_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
+{
+    unsigned long entries = 0;
+    unsigned int i;
+
+    for (i = 0; i < nr_shards; i++)
+        entries += READ_ONCE(shards[i].nr_entries);
+    return entries ?: SHRINK_EMPTY;
+}
+
+static unsigned long rbtree_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
+{
+    static unsigned int next_shard;   // 每次從不同的 shard 開始，不要老是清同一個
+    unsigned long freed = 0, per_shard;
+    struct rbtree_shard *sh;
+    unsigned int i;
+
+    per_shard = DIV_ROUND_UP(sc->nr_to_scan, nr_shards);
+    for (i = 0; i < nr_shards && freed < sc->nr_to_scan; i++) {
+        unsigned long n = 0;
+
+        sh = &shards[(READ_ONCE(next_shard) + i) % nr_shards];
+        spin_lock_bh(&sh->lock);
+        while (n < per_shard && rbtree_evict_one(sh))
+            n++;
+        spin_unlock_bh(&sh->lock);
+        freed += n;
+    }
+    WRITE_ONCE(next_shard, (READ_ONCE(next_shard) + 1) % nr_shards);
+
+    return freed ?: SHRINK_STOP;
+}
+
+// 卸載時把每顆 CPU 節點池裡的節點還給 slab
+static void rbtree_pool_destroy(void)
+{
+    struct rbtree_pool *pool;
+    int cpu;
+
+    if (!pools)
+        return;
+    for_each_possible_cpu(cpu) {
+        pool = per_cpu_ptr(pools, cpu);
+        cancel_work_sync(&pool->refill);
+        while (pool->nr)
+            kmem_cache_free(node_cache, pool->objs[--pool->nr]);
+    }
+    free_percpu(pools);
+    pools = NULL;
+}
+
+static int rbtree_pool_create(void)
+{
+    struct rbtree_pool *pool;
+    struct my_node *data;
+    int cpu;
+
+    pools = alloc_percpu(struct rbtree_pool);
+    if (!pools)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu)
+        INIT_WORK(&per_cpu_ptr(pools, cpu)->refill, rbtree_pool_refill);
+    for_each_possible_cpu(cpu) {
+        pool = per_cpu_ptr(pools, cpu);
+        while (pool->nr < pool_size) {
+            data = kmem_cache_alloc(node_cache, GFP_KERNEL);
+            if (!data)
+                return -ENOMEM;
+            pool->objs[pool->nr++] = data;
+        }
+    }
+    return 0;
+}
 
-// Red-Black Tree
-static struct rb_root my_tree = RB_ROOT;
+// `cat /proc/rbtree` 會列出所有節點
+// 格式：key ttl=剩餘秒數(-1 表示不過期) value=hex
+// 各 shard 依 key 合併輸出，看起來跟一棵樹一樣
+//
+// 每次 read() 只產生放得進 seq_file buffer 的節點：stop() 時記下下一個要輸出的 key，
+// 下次 start() 直接從那個 key 找回來 (O(log n))，不需要從頭走，也不會一次把整棵樹印進記憶體。
+// 同一個 fd 先寫入 "range <lo> <hi>" 再讀，就只輸出 lo..hi 之間的節點。
+struct rbtree_seq {
+    struct rbtree_iter it;
+    loff_t pos;    // 下一個要輸出的位置 (0 是標題列)
+    int key;       // pos 對應的節點的 key，從這裡恢復
+    bool end;      // 已經走完
+    int lo, hi;    // 輸出範圍
+};
 
-// 插入節點
-static struct my_node *rbtree_insert(int key)
+// 從 st->key 開始找出位置 st->pos 的節點 (rcu_read_lock() 內)
+static struct my_node *rbtree_seq_resume(struct rbtree_seq *st)
 {
-    struct rb_node **new = &(my_tree.rb_node), *parent = NULL;
     struct my_node *data;
 
-    while (*new) {
-        struct my_node *this = container_of(*new, struct my_node, node);
-        parent = *new;
-        
-        if (key < this->key)
-            new = &((*new)->rb_left);
-        else if (key > this->key)
-            new = &((*new)->rb_right);
-        else
-            return NULL;  // Key 已存在
-    }
-
-    data = kmalloc(sizeof(struct my_node), GFP_KERNEL);
-    if (!data)
+    if (st->end)
         return NULL;
-
-    data->key = key;
-    rb_link_node(&data->node, parent, new);
-    rb_insert_color(&data->node, &my_tree);
-
+    rbtree_iter_seek(&st->it, st->key);
+    data = rbtree_iter_next_live(&st->it, st->hi);
+    if (data)
+        st->key = data->key;
+    else
+        st->end = true;
     return data;
 }
 
-// 刪除節點
-static int rbtree_delete(int key)
+static void *rbtree_seq_next(struct seq_file *m, void *v, loff_t *pos)
 {
-    struct rb_node *node = my_tree.rb_node;
+    struct rbtree_seq *st = m->private;
+    struct my_node *data;
 
-    while (node) {
-        struct my_node *data = container_of(node, struct my_node, node);
+    ++*pos;
+    st->pos = *pos;
+    if (v == SEQ_START_TOKEN)
+        return rbtree_seq_resume(st);
 
-        if (key < data->key)
-            node = node->rb_left;
-        else if (key > data->key)
-            node = node->rb_right;
-        else {
-            rb_erase(&data->node, &my_tree);
-            kfree(data);
-            return 1;  // 成功刪除
-        }
-    }
-    return 0;  // 找不到 key
+    data = rbtree_iter_next_live(&st->it, st->hi);
+    if (data)
+        st->key = data->key;
+    else
+        st->end = true;
+    return data;
 }
 
-// 釋放所有節點
-static void rbtree_free(void)
+static void *rbtree_seq_start(struct seq_file *m, loff_t *pos)
 {
-    struct rb_node *node;
+    struct rbtree_seq *st = m->private;
     struct my_node *data;
+    loff_t i;
 
-    while ((node = rb_first(&my_tree))) {
-        data = container_of(node, struct my_node, node);
-        rb_erase(node, &my_tree);
-        kfree(data);
-    }
+    rcu_read_lock();
+    if (*pos == st->pos && *pos)
+        return rbtree_seq_resume(st);   // 接著上一次 read() 的地方
+
+    // 第一次讀或 lseek 到別的位置：從頭開始數
+    st->key = st->lo;
+    st->end = false;
+    st->pos = 0;
+    if (!*pos)
+        return SEQ_START_TOKEN;
+
+    for (i = 0, data = SEQ_START_TOKEN; data && i < *pos; )
+        data = rbtree_seq_next(m, data, &i);
+    st->pos = *pos;
+    return data;
 }
 
-// `cat /proc/rbtree` 會列出所有節點
-static int rbtree_show(struct seq_file *m, void *v)
+static void rbtree_seq_stop(struct seq_file *m, void *v)
 {
-    struct rb_node *node;
-    struct my_node *data;
+    rcu_read_unlock();
+}
+
+static int rbtree_seq_show(struct seq_file *m, void *v)
+{
+    struct my_node *data = v;
+    long ttl;
 
-    seq_printf(m, "Red-Black Tree Contents:\n");
-    for (node = rb_first(&my_tree); node; node = rb_next(node)) {
-        data = container_of(node, struct my_node, node);
-        seq_printf(m, "%d\n", data->key);
+    if (v == SEQ_START_TOKEN) {
+        seq_printf(m, "Red-Black Tree Contents:\n");
+        return 0;
     }
+    ttl = data->expires ? (long)(data->expires - jiffies) / HZ : -1;
+    seq_printf(m, "%d ttl=%ld value=%*phN\n", data->key, ttl, data->len, data->value);
     return 0;
 }
 
+static const struct seq_operations rbtree_seq_ops = {
+    .start = rbtree_seq_start,
+    .next  = rbtree_seq_next,
+    .stop  = rbtree_seq_stop,
+    .show  = rbtree_seq_show,
+};
+
 // `seq_file` 介面
 static int rbtree_open(struct inode *inode, struct file *file)
 {
-    return single_open(file, rbtree_show, NULL);
+    struct rbtree_seq *st;
+    int ret;
+
+    st = __seq_open_private(file, &rbtree_seq_ops, sizeof(*st));
+    if (!st)
+        return -ENOMEM;
+    st->lo = INT_MIN;
+    st->hi = INT_MAX;
+    st->key = INT_MIN;
+    ret = rbtree_iter_init(&st->it);
+    if (ret)
+        seq_release_private(inode, file);
+    return ret;
+}
+
+static int rbtree_release(struct inode *inode, struct file *file)
+{
+    struct rbtree_seq *st = ((struct seq_file *)file->private_data)->private;
+
+    rbtree_iter_destroy(&st->it);
+    return seq_release_private(inode, file);
 }
 
-// `/proc/rbtree` 寫入處理 (用於插入/刪除節點)
+// `/proc/rbtree` 寫入處理
+//   add <key> [hex value|-] [ttl 秒] 插入或更新，"-" 表示沒有 value
+//   del <key>                        刪除
+//   get <key>                        查詢，結果印在 dmesg
+//   range <lo> <hi>                  之後從同一個 fd 讀只輸出 lo..hi (fd 會倒回開頭重新讀)
 static ssize_t rbtree_write(struct file *file, const char __user *buffer, size_t count, loff_t *pos)
 {
-    char input[32];
-    int key;
-    
+    char input[RBTREE_CMD_MAX];
+    char hex[2 * RBTREE_VALUE_MAX + 1];
+    u8 value[RBTREE_VALUE_MAX];
+    unsigned int ttl = default_ttl;
+    size_t len = 0;
+    int key, hi, n, ret = 0;
+
     if (count > sizeof(input) - 1)
         return -EINVAL;
 
@@ -113,13 +1284,43 @@ static ssize_t rbtree_write(struct file *file, const char __user *buffer, size_t
 
     input[count] = '\0';
 
-    if (sscanf(input, "add %d", &key) == 1) {
-        rbtree_insert(key);
+    if ((n = sscanf(input, "add %d %128s %u", &key, hex, &ttl)) >= 1) {
+        if (n >= 2 && strcmp(hex, "-")) {
+            len = strlen(hex) / 2;
+            if ((strlen(hex) & 1) || hex2bin(value, hex, len))
+                return -EINVAL;
+        }
+        ret = rbtree_insert(key, value, len, ttl, GFP_KERNEL);
     } else if (sscanf(input, "del %d", &key) == 1) {
         rbtree_delete(key);
+    } else if (sscanf(input, "get %d", &key) == 1) {
+        ret = rbtree_lookup(key, value, sizeof(value));
+        if (ret >= 0)
+            pr_info("rbtree: get %d -> %*phN\n", key, ret, value);
+        else
+            pr_info("rbtree: get %d -> miss\n", key);
+        ret = 0;
+    } else if (sscanf(input, "range %d %d", &key, &hi) == 2) {
+        struct seq_file *m = file->private_data;
+        struct rbtree_seq *st = m->private;
+
+        if (key > hi)
+            return -EINVAL;
+        // 範圍改了，上一次記下的恢復點和 seq_file 裡已經產生的輸出都不能再用，整個 fd 倒回開頭；
+        // 拿 m->lock 和同一個 fd 上的 read()/lseek() 互斥
+        mutex_lock(&m->lock);
+        st->lo = key;
+        st->hi = hi;
+        st->pos = 0;
+        m->index = 0;
+        m->count = 0;
+        m->from = 0;
+        m->read_pos = 0;
+        *pos = 0;
+        mutex_unlock(&m->lock);
     }
 
-    return count;
+    return ret ? ret : count;
 }
 
 // `/proc/rbtree` 檔案的 file_operations
@@ -128,29 +1329,833 @@ static const struct proc_ops rbtree_fops = {
     .proc_read    = seq_read,
     .proc_write   = rbtree_write,
     .proc_lseek   = seq_lseek,
+    .proc_release = rbtree_release,
+};
+
+// `cat /proc/rbtree_stats`：每個節點實際佔用的記憶體
+// kmalloc_entry_bytes 是同樣大小的節點改用 kmalloc() 時會落到的 bucket，方便比較
+static int rbtree_stats_show(struct seq_file *m, void *v)
+{
+    struct rbtree_shard *sh;
+    struct my_node *data;
+    unsigned long entries = 0, pooled = 0, bt_nodes = 0, sum;
+    unsigned long hist[RBTREE_LAT_BUCKETS];
+    unsigned int i, k, entry_bytes = kmem_cache_size(node_cache);
+    int cpu;
+
+    for (i = 0; i < nr_shards; i++) {
+        entries += READ_ONCE(shards[i].nr_entries);
+        bt_nodes += READ_ONCE(shards[i].bt_nodes);
+    }
+    for_each_possible_cpu(cpu)
+        pooled += READ_ONCE(per_cpu_ptr(pools, cpu)->nr);
+
+    seq_printf(m, "backend: %s\n", backend_names[backend_type]);
+    seq_printf(m, "entries: %lu\n", entries);
+    seq_printf(m, "value_size: %u\n", value_size);
+    seq_printf(m, "entry_bytes: %u\n", entry_bytes);
+    seq_printf(m, "kmalloc_entry_bytes: %zu\n",
+               kmalloc_size_roundup(struct_size(data, value, value_size)));
+    seq_printf(m, "pooled_entries: %lu\n", pooled);
+    seq_printf(m, "btree_nodes: %lu\n", bt_nodes);
+    seq_printf(m, "btree_node_bytes: %zu\n", bt_node_bytes());
+    seq_printf(m, "total_bytes: %lu\n", (entries + pooled) * entry_bytes + bt_nodes * bt_node_bytes());
+
+    seq_printf(m, "max_entries_per_shard: %lu\n", rbtree_shard_cap());
+    seq_printf(m, "max_bytes_per_shard: %lu\n", rbtree_shard_bytes());
+
+    for (i = 0; i < NR_STATS; i++) {
+        sum = 0;
+        for_each_possible_cpu(cpu)
+            sum += per_cpu(rbtree_stats.count[i], cpu);
+        seq_printf(m, "%s: %lu\n", stat_names[i], sum);
+    }
+
+    // latency_stats=0 時不會累加
+    for (i = 0; i < NR_LAT; i++) {
+        memset(hist, 0, sizeof(hist));
+        for (k = 0; k < RBTREE_LAT_BUCKETS; k++) {
+            for_each_possible_cpu(cpu)
+                hist[k] += per_cpu(rbtree_stats.lat[i][k], cpu);
+        }
+        seq_printf(m, "%s_latency_ns:\n", lat_names[i]);
+        rbtree_lat_show(m, hist);
+    }
+
+    seq_printf(m, "shards: %u\n", nr_shards);
+    for (i = 0; i < nr_shards; i++) {
+        sh = &shards[i];
+        spin_lock_bh(&sh->lock);
+        seq_printf(m, "shard %u: entries %lu\n", i, sh->nr_entries);
+        spin_unlock_bh(&sh->lock);
+    }
+    return 0;
+}
+
+static int rbtree_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rbtree_stats_show, NULL);
+}
+
+static const struct proc_ops rbtree_stats_fops = {
+    .proc_open    = rbtree_stats_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
     .proc_release = single_release,
 };
 
+// 執行一個 binary 操作，結果寫回 op->result
+static void rbtree_do_op(struct rbtree_op *op)
+{
+    unsigned int ttl = op->ttl == RBTREE_TTL_DEFAULT ? default_ttl : op->ttl;
+    int ret;
+
+    switch (op->op) {
+    case RBTREE_OP_INSERT:
+        ret = rbtree_insert(op->key, op->value, op->len, ttl, GFP_KERNEL);
+        break;
+    case RBTREE_OP_DELETE:
+        ret = rbtree_delete(op->key) ? 0 : -ENOENT;
+        break;
+    case RBTREE_OP_LOOKUP:
+        ret = rbtree_lookup(op->key, op->value, sizeof(op->value));
+        if (ret >= 0) {
+            op->len = ret;
+            ret = 0;
+        }
+        break;
+    default:
+        ret = -EINVAL;
+        break;
+    }
+    op->result = ret;
+}
+
+// `/dev/rbtree` 的 RBTREE_IOC_BATCH：一次 syscall 處理一整個陣列的操作
+// 每次搬 RBTREE_BATCH_CHUNK 筆進來處理完再搬回去，不管陣列多大都只用固定大小的 buffer
+static long rbtree_ioctl_batch(struct rbtree_batch __user *ubatch)
+{
+    struct rbtree_batch batch;
+    struct rbtree_op *ops, __user *uops;
+    unsigned int i, n;
+    long ret = 0;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    uops = u64_to_user_ptr(batch.ops);
+
+    ops = kmalloc_array(RBTREE_BATCH_CHUNK, sizeof(*ops), GFP_KERNEL);
+    if (!ops)
+        return -ENOMEM;
+
+    for (batch.done = 0; batch.done < batch.count; batch.done += n) {
+        if (batch.done && signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+        n = min_t(unsigned int, batch.count - batch.done, RBTREE_BATCH_CHUNK);
+        if (copy_from_user(ops, uops + batch.done, n * sizeof(*ops))) {
+            ret = -EFAULT;
+            break;
+        }
+        for (i = 0; i < n; i++)
+            rbtree_do_op(&ops[i]);
+        if (copy_to_user(uops + batch.done, ops, n * sizeof(*ops))) {
+            ret = -EFAULT;
+            break;
+        }
+        cond_resched();
+    }
+    kfree(ops);
+
+    // 被 signal 打斷也算成功，user space 從 done 知道做到哪裡
+    if (put_user(batch.done, &ubatch->done))
+        return -EFAULT;
+    return ret == -EINTR ? 0 : ret;
+}
+
+// RBTREE_IOC_RANGE：依序回傳 lo..hi 之間最多 max 個節點
+// 每次在 RCU 下收集 RBTREE_BATCH_CHUNK 個，出了 RCU 再 copy_to_user()，
+// 下一輪從最後一個 key + 1 找回來，所以回傳多少筆都只用固定大小的 buffer
+static long rbtree_ioctl_range(struct rbtree_range __user *urange)
+{
+    struct rbtree_range range;
+    struct rbtree_op *ops, __user *uops;
+    struct rbtree_iter it;
+    struct my_node *data;
+    unsigned int n;
+    long ret = 0;
+    int key;
+    bool end = false;
+
+    if (copy_from_user(&range, urange, sizeof(range)))
+        return -EFAULT;
+    if (range.lo > range.hi)
+        return -EINVAL;
+    uops = u64_to_user_ptr(range.ops);
+
+    ops = kmalloc_array(RBTREE_BATCH_CHUNK, sizeof(*ops), GFP_KERNEL);
+    if (!ops)
+        return -ENOMEM;
+    if (rbtree_iter_init(&it)) {
+        kfree(ops);
+        return -ENOMEM;
+    }
+
+    key = range.lo;
+    for (range.count = 0; range.count < range.max && !end; range.count += n) {
+        rcu_read_lock();
+        rbtree_iter_seek(&it, key);
+        for (n = 0; n < min_t(unsigned int, range.max - range.count, RBTREE_BATCH_CHUNK); n++) {
+            data = rbtree_iter_next_live(&it, range.hi);
+            if (!data) {
+                end = true;
+                break;
+            }
+            ops[n].op = RBTREE_OP_LOOKUP;
+            ops[n].key = data->key;
+            ops[n].ttl = data->expires ? max_t(long, (long)(data->expires - jiffies) / HZ, 1) : 0;
+            ops[n].len = data->len;
+            ops[n].result = 0;
+            memcpy(ops[n].value, data->value, data->len);
+            memset(ops[n].value + data->len, 0, sizeof(ops[n].value) - data->len);
+            if (data->key == INT_MAX)
+                end = true;
+            else
+                key = data->key + 1;
+        }
+        rcu_read_unlock();
+
+        if (copy_to_user(uops + range.count, ops, n * sizeof(*ops))) {
+            ret = -EFAULT;
+            break;
+        }
+        cond_resched();
+    }
+
+    rbtree_iter_destroy(&it);
+    kfree(ops);
+    if (!ret && put_user(range.count, &urange->count))
+        ret = -EFAULT;
+    return ret;
+}
+
+static long rbtree_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case RBTREE_IOC_BATCH:
+        return rbtree_ioctl_batch((struct rbtree_batch __user *)arg);
+    case RBTREE_IOC_RANGE:
+        return rbtree_ioctl_range((struct rbtree_range __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+static const struct file_operations rbtree_dev_fops = {
+    .owner          = THIS_MODULE,
+    .unlocked_ioctl = rbtree_ioctl,
+    .compat_ioctl   = compat_ptr_ioctl,
+};
+
+static struct miscdevice rbtree_miscdev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name  = PROC_NAME,
+    .fops  = &rbtree_dev_fops,
+    .mode  = 0666,
+};
+
+/* ---------------- 索引 benchmark ---------------- */
+
+// echo N > /sys/kernel/debug/rbtree/index_bench
+// 分別用兩種 backend 建一個私有 shard，插入 N 個 key 再隨機查詢 N 次，量每次操作平均幾 ns。
+// 只量索引本身：節點事先配好，不經過節點池、淘汰和 TTL。
+static struct dentry *rbtree_debugfs;
+static DEFINE_MUTEX(index_bench_lock);
+static char index_bench_result[256];
+
+struct index_bench_stat {
+    u64 insert_ns;
+    u64 lookup_ns;
+    unsigned long misses;
+};
+
+static int index_bench_run(bool btree, struct my_node **nodes, unsigned int n,
+                           struct index_bench_stat *st)
+{
+    struct rbtree_shard *sh;
+    struct my_node *data;
+    unsigned int i, idx;
+    u64 start;
+    int ret = 0;
+
+    sh = kzalloc(sizeof(*sh), GFP_KERNEL);
+    if (!sh)
+        return -ENOMEM;
+    rbtree_shard_init(sh, btree);
+
+    start = ktime_get_ns();
+    for (i = 0; i < n && !ret; i++) {
+        spin_lock_bh(&sh->lock);
+        ret = rbtree_index_insert(sh, nodes[i]);
+        if (!ret)
+            list_add_tail(&nodes[i]->lru, &sh->lru);
+        spin_unlock_bh(&sh->lock);
+        if (!(i % 4096))
+            cond_resched();
+    }
+    st->insert_ns = div_u64(ktime_get_ns() - start, n);
+
+    // 查詢順序打散，不要沿著插入順序剛好命中 cache
+    start = ktime_get_ns();
+    for (i = 0; i < n && !ret; i += 4096) {
+        unsigned int j, end = min(n, i + 4096);
+
+        rcu_read_lock();
+        for (j = i; j < end; j++) {
+            idx = hash_32(j ^ n, 32) % n;
+            data = rbtree_search(sh, nodes[idx]->key);
+            if (data != nodes[idx])
+                st->misses++;
+        }
+        rcu_read_unlock();
+        cond_resched();
+    }
+    st->lookup_ns = div_u64(ktime_get_ns() - start, n);
+
+    // 沒有其他 reader，直接丟掉整個索引；節點由呼叫者釋放，下一個 backend 插入時會重新初始化
+    bt_destroy(rcu_dereference_protected(sh->bt_root, 1));
+    kfree(sh);
+    return ret;
+}
+
+static int index_bench(unsigned int n)
+{
+    struct index_bench_stat st[2] = {};
+    struct my_node **nodes;
+    unsigned int i, b;
+    int ret = 0;
+
+    nodes = kvmalloc_array(n, sizeof(*nodes), GFP_KERNEL);
+    if (!nodes)
+        return -ENOMEM;
+    for (i = 0; i < n; i++) {
+        nodes[i] = kmem_cache_alloc(node_cache, GFP_KERNEL | __GFP_NOWARN);
+        if (!nodes[i]) {
+            ret = -ENOMEM;
+            break;
+        }
+        nodes[i]->key = (int)hash_32(i, 32);   // hash_32 是 u32 上的一對一映射，key 不會重複
+        nodes[i]->len = 0;
+        if (!(i % 4096))
+            cond_resched();
+    }
+
+    for (b = 0; b < ARRAY_SIZE(st) && !ret; b++)
+        ret = index_bench_run(b == BACKEND_BTREE, nodes, n, &st[b]);
+
+    while (i)
+        kmem_cache_free(node_cache, nodes[--i]);
+    kvfree(nodes);
+    if (ret)
+        return ret;
+
+    scnprintf(index_bench_result, sizeof(index_bench_result),
+              "keys: %u\n"
+              "%-6s insert %llu ns/op lookup %llu ns/op misses %lu\n"
+              "%-6s insert %llu ns/op lookup %llu ns/op misses %lu\n",
+              n,
+              backend_names[BACKEND_RBTREE], st[BACKEND_RBTREE].insert_ns,
+              st[BACKEND_RBTREE].lookup_ns, st[BACKEND_RBTREE].misses,
+              backend_names[BACKEND_BTREE], st[BACKEND_BTREE].insert_ns,
+              st[BACKEND_BTREE].lookup_ns, st[BACKEND_BTREE].misses);
+    pr_info("rbtree: index_bench %u keys: rbtree %llu/%llu ns, btree %llu/%llu ns (insert/lookup)\n",
+            n, st[BACKEND_RBTREE].insert_ns, st[BACKEND_RBTREE].lookup_ns,
+            st[BACKEND_BTREE].insert_ns, st[BACKEND_BTREE].lookup_ns);
+    return 0;
+}
+
+static ssize_t index_bench_write(struct file *file, const char __user *ubuf,
+                                 size_t count, loff_t *ppos)
+{
+    unsigned int n;
+    int ret;
+
+    ret = kstrtouint_from_user(ubuf, count, 0, &n);
+    if (ret)
+        return ret;
+    if (!n || n > INDEX_BENCH_MAX_KEYS)
+        return -EINVAL;
+
+    mutex_lock(&index_bench_lock);
+    ret = index_bench(n);
+    mutex_unlock(&index_bench_lock);
+    return ret ?: count;
+}
+
+static ssize_t index_bench_read(struct file *file, char __user *ubuf,
+                                size_t count, loff_t *ppos)
+{
+    ssize_t ret;
+
+    mutex_lock(&index_bench_lock);
+    ret = simple_read_from_buffer(ubuf, count, ppos, index_bench_result,
+                                  strlen(index_bench_result));
+    mutex_unlock(&index_bench_lock);
+    return ret;
+}
+
+static const struct file_operations index_bench_fops = {
+    .owner = THIS_MODULE,
+    .read  = index_bench_read,
+    .write = index_bench_write,
+    .llseek = default_llseek,
+};
+
+/* ---------------- 快取 benchmark ---------------- */
+
+// echo "threads=4 ops=1000000 keys=100000 dist=zipf mix=10:80:10" > /sys/kernel/debug/rbtree/bench
+// cat /sys/kernel/debug/rbtree/bench
+//
+// 用 kthread 對真正的快取 (節點池、shard 鎖、淘汰都算在內) 跑 insert/lookup/delete，
+// mix 是三種操作的百分比。會覆寫 key 0..keys-1，有 lookup 或 delete 時先把整個 keyspace 填滿。
+// 每個操作前後各讀一次 ktime_get_ns()，延遲裡包含約數十 ns 的計時成本。
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_OPS 100000000UL
+#define BENCH_MAX_KEYS (1U << 22)    // zipf 的 CDF 表每個 key 8 bytes
+
+enum { BENCH_INSERT, BENCH_LOOKUP, BENCH_DELETE, BENCH_NR_OPS };
+static const char * const bench_op_names[] = { "insert", "lookup", "delete" };
+
+enum { DIST_SEQ, DIST_UNIFORM, DIST_ZIPF };
+static const char * const bench_dist_names[] = { "seq", "uniform", "zipf" };
+
+struct bench_cfg {
+    unsigned int threads;
+    unsigned int keys;
+    int dist;
+    unsigned int mix[BENCH_NR_OPS];
+    unsigned long ops;          // 每個 thread
+};
+
+struct bench_hist {
+    unsigned long count;
+    u64 ns;
+    unsigned long buckets[RBTREE_LAT_BUCKETS];
+};
+
+struct bench_thread {
+    const struct bench_cfg *cfg;
+    const u64 *zipf_cdf;        // zipf_cdf[i] = sum(2^32 / (j + 1)), j = 0..i
+    unsigned int base;          // seq 模式下這個 thread 的起點，各 thread 錯開
+    struct completion *done;
+    struct bench_hist hist[BENCH_NR_OPS];
+};
+
+struct bench_result {
+    struct bench_cfg cfg;
+    u64 ns;
+    struct bench_hist hist[BENCH_NR_OPS];
+};
+
+static DEFINE_MUTEX(bench_lock);
+static struct bench_result bench_last;   // 上一次的結果 (受 bench_lock 保護)
+
+// s = 1 的 Zipf：rank i 被選中的機率與 1 / (i + 1) 成正比，key 0 最熱門
+static u64 *bench_zipf_build(unsigned int keys)
+{
+    u64 *cdf, sum = 0;
+    unsigned int i;
+
+    cdf = kvmalloc_array(keys, sizeof(*cdf), GFP_KERNEL);
+    if (!cdf)
+        return NULL;
+    for (i = 0; i < keys; i++) {
+        sum += div_u64(1ULL << 32, i + 1);
+        cdf[i] = sum;
+    }
+    return cdf;
+}
+
+static unsigned int bench_zipf(const u64 *cdf, unsigned int keys)
+{
+    u64 r = mul_u64_u64_shr(get_random_u64(), cdf[keys - 1], 64);
+    unsigned int lo = 0, hi = keys - 1, mid;
+
+    // 第一個 cdf[i] > r 的位置
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cdf[mid] > r)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+static int bench_next_key(struct bench_thread *t, unsigned long i)
+{
+    const struct bench_cfg *cfg = t->cfg;
+
+    switch (cfg->dist) {
+    case DIST_SEQ:
+        return (t->base + i) % cfg->keys;
+    case DIST_UNIFORM:
+        return get_random_u32_below(cfg->keys);
+    default:
+        return bench_zipf(t->zipf_cdf, cfg->keys);
+    }
+}
+
+static int bench_next_op(const struct bench_cfg *cfg)
+{
+    unsigned int r = get_random_u32_below(100);
+
+    if (r < cfg->mix[BENCH_INSERT])
+        return BENCH_INSERT;
+    if (r < cfg->mix[BENCH_INSERT] + cfg->mix[BENCH_LOOKUP])
+        return BENCH_LOOKUP;
+    return BENCH_DELETE;
+}
+
+static void bench_hist_add(struct bench_hist *h, u64 ns)
+{
+    h->count++;
+    h->ns += ns;
+    h->buckets[rbtree_lat_bucket(ns)]++;
+}
+
+static int bench_thread_fn(void *arg)
+{
+    struct bench_thread *t = arg;
+    const struct bench_cfg *cfg = t->cfg;
+    u8 buf[RBTREE_VALUE_MAX];
+    unsigned long i;
+    u64 start;
+    int key, op;
+
+    memset(buf, 0xa5, sizeof(buf));
+    for (i = 0; i < cfg->ops; i++) {
+        key = bench_next_key(t, i);
+        op = bench_next_op(cfg);
+
+        start = ktime_get_ns();
+        switch (op) {
+        case BENCH_INSERT:
+            rbtree_insert(key, buf, value_size, default_ttl, GFP_KERNEL);
+            break;
+        case BENCH_LOOKUP:
+            rbtree_lookup(key, buf, sizeof(buf));
+            break;
+        case BENCH_DELETE:
+            rbtree_delete(key);
+            break;
+        }
+        bench_hist_add(&t->hist[op], ktime_get_ns() - start);
+
+        if (!(i % 1024))
+            cond_resched();
+    }
+    complete(t->done);
+    return 0;
+}
+
+static int bench_run(const struct bench_cfg *cfg, struct bench_result *res)
+{
+    DECLARE_COMPLETION_ONSTACK(done);
+    struct task_struct **tasks;
+    struct bench_thread *threads;
+    u8 value[RBTREE_VALUE_MAX] = {};
+    u64 *cdf = NULL;
+    unsigned int i, j, k, started = 0;
+    u64 start;
+    int ret = -ENOMEM;
+
+    threads = kcalloc(cfg->threads, sizeof(*threads), GFP_KERNEL);
+    tasks = kcalloc(cfg->threads, sizeof(*tasks), GFP_KERNEL);
+    if (!threads || !tasks)
+        goto out;
+    if (cfg->dist == DIST_ZIPF) {
+        cdf = bench_zipf_build(cfg->keys);
+        if (!cdf)
+            goto out;
+    }
+
+    if (cfg->mix[BENCH_LOOKUP] || cfg->mix[BENCH_DELETE]) {
+        for (i = 0; i < cfg->keys; i++) {
+            rbtree_insert(i, value, value_size, default_ttl, GFP_KERNEL);
+            if (!(i % 4096))
+                cond_resched();
+        }
+    }
+
+    for (i = 0; i < cfg->threads; i++) {
+        threads[i].cfg = cfg;
+        threads[i].zipf_cdf = cdf;
+        threads[i].base = div_u64((u64)i * cfg->keys, cfg->threads);
+        threads[i].done = &done;
+        tasks[i] = kthread_create(bench_thread_fn, &threads[i], "rbtree_bench/%u", i);
+        if (IS_ERR(tasks[i])) {
+            ret = PTR_ERR(tasks[i]);
+            goto stop;
+        }
+        get_task_struct(tasks[i]);
+        started++;
+    }
+
+    start = ktime_get_ns();
+    for (i = 0; i < started; i++)
+        wake_up_process(tasks[i]);
+    // 每個 thread 跑完都會 complete() 一次
+    for (i = 0; i < started; i++)
+        wait_for_completion(&done);
+    res->ns = ktime_get_ns() - start;
+
+    res->cfg = *cfg;
+    memset(res->hist, 0, sizeof(res->hist));
+    for (i = 0; i < started; i++) {
+        for (j = 0; j < BENCH_NR_OPS; j++) {
+            res->hist[j].count += threads[i].hist[j].count;
+            res->hist[j].ns += threads[i].hist[j].ns;
+            for (k = 0; k < RBTREE_LAT_BUCKETS; k++)
+                res->hist[j].buckets[k] += threads[i].hist[j].buckets[k];
+        }
+    }
+    ret = 0;
+
+stop:
+    // 失敗時 thread 都還沒被喚醒，stop 掉就好
+    for (i = 0; i < started; i++) {
+        kthread_stop(tasks[i]);
+        put_task_struct(tasks[i]);
+    }
+out:
+    kvfree(cdf);
+    kfree(tasks);
+    kfree(threads);
+    return ret;
+}
+
+// 解析 "name=value" 以空白分隔的設定，沒給的欄位用預設值 (threads 預設每顆 CPU 一個，最多 BENCH_MAX_THREADS)
+static int bench_parse(char *buf, struct bench_cfg *cfg)
+{
+    char *tok, *val;
+    int ret = 0;
+
+    *cfg = (struct bench_cfg) {
+        .threads = min_t(unsigned int, num_online_cpus(), BENCH_MAX_THREADS),
+        .keys = 10000,
+        .dist = DIST_UNIFORM,
+        .mix = { 10, 80, 10 },
+        .ops = 100000,
+    };
+
+    while (!ret && (tok = strsep(&buf, " \t\n"))) {
+        if (!*tok)
+            continue;
+        val = strchr(tok, '=');
+        if (!val)
+            return -EINVAL;
+        *val++ = '\0';
+
+        if (!strcmp(tok, "threads")) {
+            ret = kstrtouint(val, 0, &cfg->threads);
+        } else if (!strcmp(tok, "ops")) {
+            ret = kstrtoul(val, 0, &cfg->ops);
+        } else if (!strcmp(tok, "keys")) {
+            ret = kstrtouint(val, 0, &cfg->keys);
+        } else if (!strcmp(tok, "dist")) {
+            cfg->dist = sysfs_match_string(bench_dist_names, val);
+            ret = cfg->dist < 0 ? -EINVAL : 0;
+        } else if (!strcmp(tok, "mix")) {
+            if (sscanf(val, "%u:%u:%u", &cfg->mix[BENCH_INSERT], &cfg->mix[BENCH_LOOKUP],
+                       &cfg->mix[BENCH_DELETE]) != 3)
+                ret = -EINVAL;
+        } else {
+            ret = -EINVAL;
+        }
+    }
+    if (ret)
+        return ret;
+
+    if (!cfg->threads || cfg->threads > BENCH_MAX_THREADS ||
+        !cfg->ops || cfg->ops > BENCH_MAX_OPS ||
+        !cfg->keys || cfg->keys > BENCH_MAX_KEYS ||
+        cfg->mix[BENCH_INSERT] + cfg->mix[BENCH_LOOKUP] + cfg->mix[BENCH_DELETE] != 100)
+        return -EINVAL;
+    return 0;
+}
+
+static ssize_t bench_write(struct file *file, const char __user *ubuf,
+                           size_t count, loff_t *ppos)
+{
+    struct bench_cfg cfg;
+    char *buf;
+    int ret;
+
+    buf = memdup_user_nul(ubuf, count);
+    if (IS_ERR(buf))
+        return PTR_ERR(buf);
+    ret = bench_parse(buf, &cfg);
+    kfree(buf);
+    if (ret)
+        return ret;
+
+    mutex_lock(&bench_lock);
+    ret = bench_run(&cfg, &bench_last);
+    if (!ret)
+        pr_info("rbtree: bench %u threads, %lu ops each, %s over %u keys: %llu ns\n",
+                cfg.threads, cfg.ops, bench_dist_names[cfg.dist], cfg.keys, bench_last.ns);
+    mutex_unlock(&bench_lock);
+    return ret ?: count;
+}
+
+static int bench_show(struct seq_file *m, void *v)
+{
+    const struct bench_result *res = &bench_last;
+    const struct bench_hist *h;
+    unsigned long total = 0;
+    unsigned int i;
+
+    mutex_lock(&bench_lock);
+    if (!res->ns)
+        goto out;
+
+    for (i = 0; i < BENCH_NR_OPS; i++)
+        total += res->hist[i].count;
+    seq_printf(m, "threads: %u\nops_per_thread: %lu\nkeys: %u\ndist: %s\nmix: %u:%u:%u\n",
+               res->cfg.threads, res->cfg.ops, res->cfg.keys, bench_dist_names[res->cfg.dist],
+               res->cfg.mix[BENCH_INSERT], res->cfg.mix[BENCH_LOOKUP], res->cfg.mix[BENCH_DELETE]);
+    seq_printf(m, "elapsed_ns: %llu\nops_per_sec: %llu\n",
+               res->ns, mul_u64_u64_div_u64(total, NSEC_PER_SEC, res->ns));
+
+    for (i = 0; i < BENCH_NR_OPS; i++) {
+        h = &res->hist[i];
+        if (!h->count)
+            continue;
+        seq_printf(m, "%s: ops %lu ops_per_sec %llu avg_ns %llu\n", bench_op_names[i], h->count,
+                   mul_u64_u64_div_u64(h->count, NSEC_PER_SEC, res->ns), div64_u64(h->ns, h->count));
+        rbtree_lat_show(m, h->buckets);
+    }
+out:
+    mutex_unlock(&bench_lock);
+    return 0;
+}
+
+static int bench_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, bench_show, NULL);
+}
+
+static const struct file_operations bench_fops = {
+    .owner = THIS_MODULE,
+    .open = bench_open,
+    .read = seq_read,
+    .write = bench_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
 // 模組初始化
 static int __init rbtree_init(void)
 {
-    proc_create(PROC_NAME, 0666, NULL, &rbtree_fops);
+    struct my_node *data;
+    unsigned int i;
+    int ret;
+
+    if (value_size < 1 || value_size > RBTREE_VALUE_MAX || pool_size > RBTREE_POOL_MAX) {
+        pr_err("rbtree: value_size must be 1..%d and pool_size 0..%d\n",
+               RBTREE_VALUE_MAX, RBTREE_POOL_MAX);
+        return -EINVAL;
+    }
+    if (!is_power_of_2(nr_shards) || nr_shards > RBTREE_SHARDS_MAX) {
+        pr_err("rbtree: nr_shards %u must be a power of two up to %d\n",
+               nr_shards, RBTREE_SHARDS_MAX);
+        return -EINVAL;
+    }
+    backend_type = sysfs_match_string(backend_names, backend);
+    if (backend_type < 0) {
+        pr_err("rbtree: unknown backend '%s'\n", backend);
+        return -EINVAL;
+    }
+
+    shards = kcalloc(nr_shards, sizeof(*shards), GFP_KERNEL);
+    if (!shards)
+        return -ENOMEM;
+    for (i = 0; i < nr_shards; i++)
+        rbtree_shard_init(&shards[i], backend_type == BACKEND_BTREE);
+
+    node_cache = kmem_cache_create("rbtree_node", struct_size(data, value, value_size),
+                                   0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!node_cache) {
+        kfree(shards);
+        return -ENOMEM;
+    }
+    ret = rbtree_pool_create();
+    if (ret)
+        goto err;
+
+    ret = -ENOMEM;
+    rbtree_shrinker = shrinker_alloc(0, "rbtree-netcache");
+    if (!rbtree_shrinker)
+        goto err;
+    rbtree_shrinker->count_objects = rbtree_shrink_count;
+    rbtree_shrinker->scan_objects = rbtree_shrink_scan;
+
+    if (!proc_create(PROC_NAME, 0666, NULL, &rbtree_fops))
+        goto err;
+    if (!proc_create(STATS_PROC_NAME, 0444, NULL, &rbtree_stats_fops)) {
+        remove_proc_entry(PROC_NAME, NULL);
+        goto err;
+    }
+    ret = misc_register(&rbtree_miscdev);
+    if (ret) {
+        remove_proc_entry(STATS_PROC_NAME, NULL);
+        remove_proc_entry(PROC_NAME, NULL);
+        goto err;
+    }
+
+    shrinker_register(rbtree_shrinker);
+
+    // debugfs 只用來跑 benchmark，建不起來不影響快取本身
+    rbtree_debugfs = debugfs_create_dir(PROC_NAME, NULL);
+    debugfs_create_file("index_bench", 0600, rbtree_debugfs, NULL, &index_bench_fops);
+    debugfs_create_file("bench", 0600, rbtree_debugfs, NULL, &bench_fops);
 
     // 測試插入初始數據
-    rbtree_insert(10);
-    rbtree_insert(20);
-    rbtree_insert(15);
-    rbtree_insert(30);
-    
+    rbtree_insert(10, NULL, 0, default_ttl, GFP_KERNEL);
+    rbtree_insert(20, NULL, 0, default_ttl, GFP_KERNEL);
+    rbtree_insert(15, NULL, 0, default_ttl, GFP_KERNEL);
+    rbtree_insert(30, NULL, 0, default_ttl, GFP_KERNEL);
+
+    if (reap_interval)
+        schedule_delayed_work(&rbtree_reap_work, reap_interval * HZ);
+
     printk(KERN_INFO "rbtree_driver loaded.\n");
     return 0;
+
+err:
+    shrinker_free(rbtree_shrinker);
+    rbtree_pool_destroy();
+    kmem_cache_destroy(node_cache);
+    kfree(shards);
+    return ret;
 }
 
 // 模組卸載
 static void __exit rbtree_exit(void)
 {
+    debugfs_remove_recursive(rbtree_debugfs);
+    misc_deregister(&rbtree_miscdev);
+    remove_proc_entry(STATS_PROC_NAME, NULL);
     remove_proc_entry(PROC_NAME, NULL);
+    shrinker_free(rbtree_shrinker);
+    cancel_delayed_work_sync(&rbtree_reap_work);
     rbtree_free();
+    rcu_barrier();   // 等 rbtree_node_free_rcu() 全部跑完，才能拆掉節點池和 cache
+    rbtree_pool_destroy();
+    kmem_cache_destroy(node_cache);
+    kfree(shards);
     printk(KERN_INFO "rbtree_driver unloaded.\n");
 }
 
@@ -159,4 +2164,4 @@ module_exit(rbtree_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Nick Huang");
-MODULE_DESCRIPTION("A simple Linux driver using Red-Black Tree with delete function");
+MODULE_DESCRIPTION("In-kernel key/value network cache on a Red-Black Tree or B+tree with TTL expiry");
@@ -1,62 +1,111 @@
 /*
  * rcu_example_module.c
- * Simple Linux kernel module demonstrating RCU-protected linked list
+ * Simple Linux kernel module demonstrating RCU-protected lookups
  *
  * Features:
- *  - maintain a linked list of items protected by RCU for readers
- *  - writers use a spinlock and list_add_rcu/list_del_rcu
- *  - deletion frees memory via call_rcu() callback
- *  - procfs interface to add / delete / show list:
- *      - echo "<id> <name>" > /proc/rcu_add
- *      - echo "<id>" > /proc/rcu_del
- *      - cat /proc/rcu_show
+ *  - items live in an rhashtable keyed by id: lookups are lockless under
+ *    rcu_read_lock(), writers only take the per-bucket lock, and the table
+ *    grows and shrinks with the number of items
+ *  - ids are unique; adding an existing id fails with -EEXIST
+ *  - items come from a dedicated kmem_cache; deletion frees them with
+ *    kfree_rcu(), which batches many objects per grace period
+ *  - bulk delete unlinks every item in an id range and hands them back to
+ *    the slab in batches of RCU_BULK_BATCH, one call_rcu() per batch
+ *  - updates copy the item, publish the copy in place of the old one with
+ *    rhashtable_replace_fast() and kfree_rcu() the old one, so readers see
+ *    either the old or the new name, never a missing id
+ *  - procfs interface to add / update / delete / look up / show items:
+ *      - echo "<id> <name>" > /proc/rcu_example/rcu_add
+ *      - echo "<id> <name>" > /proc/rcu_example/rcu_update
+ *      - echo "<id>" > /proc/rcu_example/rcu_del
+ *      - echo "<lo> <hi>" > /proc/rcu_example/rcu_bulk_del
+ *      - echo "<id>" > /proc/rcu_example/rcu_lookup
+ *      - cat /proc/rcu_example/rcu_show
+ *  - rcu_show holds the RCU read lock across each seq_file chunk and
+ *    resumes the table walk where the previous chunk stopped, so dumping
+ *    N items is O(N)
  *  - manual call_rcu trigger for testing
+ *  - reader-scaling benchmark comparing RCU, rwlock, spinlock and seqlock:
+ *      - echo "readers=8 writers=1 write_delay_us=1000" > /sys/kernel/debug/rcu_example/bench
+ *      - cat /sys/kernel/debug/rcu_example/bench
  *
  * Build with the provided Makefile (see below)
- * Tested with modern kernels (4.x/5.x/6.x). API used: rcu_read_lock(),
- * list_for_each_entry_rcu(), list_add_rcu(), list_del_rcu(), call_rcu().
+ * Requires Linux 6.12 or newer: module exit waits for kfree_rcu() with
+ * kvfree_rcu_barrier(), which first appeared in 6.12. The benchmark also
+ * uses cpumask_nth() and get_random_u32_below(), both older than that.
+ * API used: rcu_read_lock(),
+ * rhashtable_lookup(), rhashtable_lookup_insert_fast(),
+ * rhashtable_remove_fast(), rhashtable_replace_fast(), rhashtable_walk_*(),
+ * call_rcu(), kfree_rcu(), kmem_cache_free_bulk(), kvfree_rcu_barrier().
  */
 
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
-#include <linux/list.h>
+#include <linux/rhashtable.h>
 #include <linux/rcupdate.h>
-#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/string.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/rwlock.h>
+#include <linux/seqlock.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/random.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/cpumask.h>
 
 
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Nick Huang (example)");
 MODULE_DESCRIPTION("Simple RCU example module with procfs interface");
-MODULE_VERSION("0.2");
+MODULE_VERSION("0.3");
 
 struct rcu_item {
     int id;
     char name[32];
-    struct list_head list;
+    struct rhash_head node;
     struct rcu_head rcu;
 };
 
-static LIST_HEAD(rcu_list_head);
-static DEFINE_SPINLOCK(rcu_list_lock);
+static struct kmem_cache *rcu_item_cache;
+static struct rhashtable rcu_items;
+
+/* items unlinked by one bulk delete pass, freed together after a grace period */
+#define RCU_BULK_BATCH 256
+
+struct rcu_item_batch {
+    struct rcu_head rcu;
+    size_t nr;
+    void *items[RCU_BULK_BATCH];
+};
+
+static const struct rhashtable_params rcu_item_params = {
+    .key_len             = sizeof(int),
+    .key_offset          = offsetof(struct rcu_item, id),
+    .head_offset         = offsetof(struct rcu_item, node),
+    .automatic_shrinking = true,
+};
 
 /* forward */
 static void rcu_item_free_callback(struct rcu_head *rcu);
 
 static struct rcu_item *rcu_item_create(int id, const char *name)
 {
-    struct rcu_item *it = kmalloc(sizeof(*it), GFP_KERNEL);
+    struct rcu_item *it = kmem_cache_alloc(rcu_item_cache, GFP_KERNEL);
     if (!it)
         return NULL;
     it->id = id;
     strncpy(it->name, name, sizeof(it->name));
-    INIT_LIST_HEAD(&it->list);
     return it;
 }
 
@@ -64,88 +113,218 @@ static void rcu_item_free_callback(struct rcu_head *rcu)
 {
     struct rcu_item *it = container_of(rcu, struct rcu_item, rcu);
     pr_info("rcu_example: freeing id=%d name=%s\n", it->id, it->name);
-    kfree(it);
+    kmem_cache_free(rcu_item_cache, it);
+}
+
+static void rcu_item_batch_free(struct rcu_head *rcu)
+{
+    struct rcu_item_batch *b = container_of(rcu, struct rcu_item_batch, rcu);
+
+    kmem_cache_free_bulk(rcu_item_cache, b->nr, b->items);
+    kfree(b);
+}
+
+/*
+ * Look up an item by id. The caller must hold rcu_read_lock(); the item
+ * stays valid until rcu_read_unlock() even if it is deleted meanwhile.
+ */
+static struct rcu_item *rcu_item_lookup(int id)
+{
+    return rhashtable_lookup(&rcu_items, &id, rcu_item_params);
 }
 
 static int rcu_list_add(int id, const char *name)
 {
     struct rcu_item *it;
+    int ret;
+
     it = rcu_item_create(id, name);
     if (!it)
         return -ENOMEM;
 
-    spin_lock(&rcu_list_lock);
-    /* allow duplicates for simplicity; real code may check */
-    list_add_rcu(&it->list, &rcu_list_head);
-    spin_unlock(&rcu_list_lock);
+    ret = rhashtable_lookup_insert_fast(&rcu_items, &it->node, rcu_item_params);
+    if (ret) {
+        kmem_cache_free(rcu_item_cache, it);  /* never published */
+        return ret;
+    }
 
     pr_info("rcu_example: added id=%d name=%s\n", id, it->name);
     return 0;
 }
 
-static int rcu_list_del(int id)
+/*
+ * Copy-update: build a new item and swap it in with a single pointer
+ * publish in the bucket chain. The old item is freed after a grace period,
+ * so a reader that already holds it keeps seeing a consistent name.
+ */
+static int rcu_list_update(int id, const char *name)
 {
-    struct rcu_item *it;
-    int found = 0;
+    struct rcu_item *old, *new;
+    int ret;
 
-    spin_lock(&rcu_list_lock);
-    list_for_each_entry(it, &rcu_list_head, list) {
-        if (it->id == id) {
-            list_del_rcu(&it->list);
-            call_rcu(&it->rcu, rcu_item_free_callback);
-            found = 1;
-            pr_info("rcu_example: scheduled free id=%d name=%s\n", id, it->name);
-            break; /* remove only first match */
-        }
+    new = rcu_item_create(id, name);
+    if (!new)
+        return -ENOMEM;
+
+    rcu_read_lock();
+    do {
+        old = rcu_item_lookup(id);
+        ret = old ? rhashtable_replace_fast(&rcu_items, &old->node, &new->node,
+                                            rcu_item_params) : -ENOENT;
+        /* -ENOENT with old set: another update replaced it first, retry on its copy */
+    } while (ret == -ENOENT && old);
+    if (!ret)
+        kfree_rcu(old, rcu);
+    rcu_read_unlock();
+
+    if (ret) {
+        kmem_cache_free(rcu_item_cache, new);  /* never published */
+        return ret;
     }
-    spin_unlock(&rcu_list_lock);
 
-    return found ? 0 : -ENOENT;
+    pr_info("rcu_example: updated id=%d name=%s\n", id, new->name);
+    return 0;
 }
 
-/* seq_file implementation for /proc/rcu_show */
-static void *rcu_list_seq_start_simple(struct seq_file *s, loff_t *pos)
+static int rcu_list_del(int id)
 {
-    loff_t off = 0;
     struct rcu_item *it;
+    int found = 0;
 
     rcu_read_lock();
-    list_for_each_entry_rcu(it, &rcu_list_head, list) {
-        if (off == *pos) {
-            rcu_read_unlock();
-            return it;
-        }
-        off++;
+    it = rcu_item_lookup(id);
+    /* only the caller whose remove succeeds may free it */
+    if (it && !rhashtable_remove_fast(&rcu_items, &it->node, rcu_item_params)) {
+        pr_info("rcu_example: scheduled free id=%d name=%s\n", id, it->name);
+        kfree_rcu(it, rcu);
+        found = 1;
     }
     rcu_read_unlock();
-    return NULL;
+
+    return found ? 0 : -ENOENT;
 }
 
-static void *rcu_list_seq_next_simple(struct seq_file *s, void *v, loff_t *pos)
+/*
+ * Delete every item with lo <= id <= hi. One pass over the table fills a
+ * batch of up to RCU_BULK_BATCH unlinked items, and the whole batch is
+ * returned with kmem_cache_free_bulk() after a single grace period.
+ * rhashtable has no table-wide lock, so each removal still takes its
+ * bucket lock; the RCU read section is dropped between batches.
+ *
+ * A batch only ever ends on an item it has not removed yet. If the
+ * walker were paused on an item that has left the table,
+ * rhashtable_walk_start() would lose its place in the bucket and the
+ * rest of that bucket would never be visited. The next batch picks the
+ * item up again with rhashtable_walk_peek(). Items removed by other
+ * writers while the walk is paused can still make it skip part of a
+ * bucket; that is the usual rhashtable walker guarantee.
+ * Returns the number of items deleted.
+ */
+static int rcu_list_bulk_del(int lo, int hi)
 {
-    struct rcu_item *it = v;
-    struct rcu_item *iter;
-    loff_t off = 0;
+    struct rhashtable_iter hti;
+    struct rcu_item_batch *b;
+    struct rcu_item *it = NULL;
+    int deleted = 0;
 
-    if (!it)
-        return NULL;
+    rhashtable_walk_enter(&rcu_items, &hti);
+    do {
+        b = kmalloc(sizeof(*b), GFP_KERNEL);
+        if (!b) {
+            deleted = deleted ?: -ENOMEM;
+            break;
+        }
+        b->nr = 0;
 
-    rcu_read_lock();
-    list_for_each_entry_rcu(iter, &rcu_list_head, list) {
-        if (off > *pos) {
-            rcu_read_unlock();
-            (*pos)++;
-            return iter;
+        rhashtable_walk_start(&hti);
+        for (it = rhashtable_walk_peek(&hti); it; it = rhashtable_walk_next(&hti)) {
+            if (IS_ERR(it))     /* -EAGAIN: resized, keep walking */
+                continue;
+            if (it->id < lo || it->id > hi)
+                continue;
+            if (b->nr == RCU_BULK_BATCH)
+                break;          /* pause on @it, still in the table */
+            if (!rhashtable_remove_fast(&rcu_items, &it->node, rcu_item_params))
+                b->items[b->nr++] = it;
         }
-        off++;
+        rhashtable_walk_stop(&hti);
+
+        deleted += b->nr;
+        if (b->nr)
+            call_rcu(&b->rcu, rcu_item_batch_free);
+        else
+            kfree(b);
+        cond_resched();
+    } while (it);
+    rhashtable_walk_exit(&hti);
+
+    pr_info("rcu_example: bulk deleted %d items in [%d, %d]\n", max(deleted, 0), lo, hi);
+    return deleted;
+}
+
+/*
+ * seq_file implementation for /proc/rcu_show
+ *
+ * The rhashtable walker holds the RCU read lock from ->start() to
+ * ->stop(), i.e. across one chunk, and remembers its place between chunks.
+ * ->stop() is handed the item that did not fit, which is the last one the
+ * walker returned, so the next ->start() peeks at it again instead of
+ * advancing. If the table is resized during the walk, items may be shown
+ * twice.
+ */
+struct rcu_seq_iter {
+    struct rhashtable_iter hti;
+    loff_t pos;     /* seq_file position of the next item rhashtable_walk_next() returns */
+};
+
+static struct rcu_item *rcu_seq_walk(struct rcu_seq_iter *iter, bool peek)
+{
+    struct rcu_item *it;
+
+    /* -EAGAIN: the table was resized under us, keep going */
+    do {
+        it = peek ? rhashtable_walk_peek(&iter->hti) : rhashtable_walk_next(&iter->hti);
+    } while (IS_ERR(it) && PTR_ERR(it) == -EAGAIN);
+
+    if (!peek)
+        iter->pos++;
+    return it;
+}
+
+static void *rcu_list_seq_start(struct seq_file *s, loff_t *pos)
+{
+    struct rcu_seq_iter *iter = s->private;
+    struct rcu_item *it = NULL;
+
+    /* lseek() went backwards: restart the walk from the beginning */
+    if (*pos + 1 < iter->pos) {
+        rhashtable_walk_exit(&iter->hti);
+        rhashtable_walk_enter(&rcu_items, &iter->hti);
+        iter->pos = 0;
     }
-    rcu_read_unlock();
-    return NULL;
+
+    rhashtable_walk_start(&iter->hti);
+    if (iter->pos && *pos == iter->pos - 1)
+        return rcu_seq_walk(iter, true);
+    while (iter->pos <= *pos) {
+        it = rcu_seq_walk(iter, false);
+        if (!it)
+            break;
+    }
+    return it;
+}
+
+static void *rcu_list_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+    (*pos)++;
+    return rcu_seq_walk(s->private, false);
 }
 
 static void rcu_list_seq_stop(struct seq_file *s, void *v)
 {
-    /* nothing to do */
+    struct rcu_seq_iter *iter = s->private;
+
+    rhashtable_walk_stop(&iter->hti);
 }
 
 static int rcu_list_seq_show(struct seq_file *s, void *v)
@@ -160,22 +339,36 @@ static int rcu_list_seq_show(struct seq_file *s, void *v)
 }
 
 static const struct seq_operations rcu_seq_ops = {
-    .start = rcu_list_seq_start_simple,
-    .next  = rcu_list_seq_next_simple,
+    .start = rcu_list_seq_start,
+    .next  = rcu_list_seq_next,
     .stop  = rcu_list_seq_stop,
     .show  = rcu_list_seq_show,
 };
 
 static int rcu_proc_open(struct inode *inode, struct file *file)
 {
-    return seq_open(file, &rcu_seq_ops);
+    struct rcu_seq_iter *iter;
+
+    iter = __seq_open_private(file, &rcu_seq_ops, sizeof(*iter));
+    if (!iter)
+        return -ENOMEM;
+    rhashtable_walk_enter(&rcu_items, &iter->hti);
+    return 0;
+}
+
+static int rcu_proc_release(struct inode *inode, struct file *file)
+{
+    struct rcu_seq_iter *iter = ((struct seq_file *)file->private_data)->private;
+
+    rhashtable_walk_exit(&iter->hti);
+    return seq_release_private(inode, file);
 }
 
 static const struct proc_ops rcu_proc_fops = {
     .proc_open    = rcu_proc_open,
     .proc_read    = seq_read,
     .proc_lseek  = seq_lseek,
-    .proc_release = seq_release,
+    .proc_release = rcu_proc_release,
 };
 
 /* proc write helpers */
@@ -204,6 +397,28 @@ static ssize_t rcu_add_write(struct file *file, const char __user *buf,
     return ret ? ret : count;
 }
 
+static ssize_t rcu_update_write(struct file *file, const char __user *buf,
+                                size_t count, loff_t *ppos)
+{
+    char kbuf[64];
+    int id;
+    char name[32];
+    int ret;
+
+    if (count >= sizeof(kbuf))
+        return -EINVAL;
+
+    if (copy_from_user(kbuf, buf, count))
+        return -EFAULT;
+    kbuf[count] = '\0';
+
+    if (sscanf(kbuf, "%d %31s", &id, name) != 2)
+        return -EINVAL;
+
+    ret = rcu_list_update(id, name);
+    return ret ? ret : count;
+}
+
 static ssize_t rcu_del_write(struct file *file, const char __user *buf,
                              size_t count, loff_t *ppos)
 {
@@ -225,6 +440,51 @@ static ssize_t rcu_del_write(struct file *file, const char __user *buf,
     return ret ? ret : count;
 }
 
+static ssize_t rcu_bulk_del_write(struct file *file, const char __user *buf,
+                                  size_t count, loff_t *ppos)
+{
+    char kbuf[32];
+    int lo, hi;
+    int ret;
+
+    if (count >= sizeof(kbuf))
+        return -EINVAL;
+    if (copy_from_user(kbuf, buf, count))
+        return -EFAULT;
+    kbuf[count] = '\0';
+
+    if (sscanf(kbuf, "%d %d", &lo, &hi) != 2 || lo > hi)
+        return -EINVAL;
+
+    ret = rcu_list_bulk_del(lo, hi);
+    return ret < 0 ? ret : count;
+}
+
+static ssize_t rcu_lookup_write(struct file *file, const char __user *buf,
+                                size_t count, loff_t *ppos)
+{
+    struct rcu_item *it;
+    char kbuf[32];
+    int id;
+
+    if (count >= sizeof(kbuf))
+        return -EINVAL;
+    if (copy_from_user(kbuf, buf, count))
+        return -EFAULT;
+    kbuf[count] = '\0';
+
+    if (sscanf(kbuf, "%d", &id) != 1)
+        return -EINVAL;
+
+    rcu_read_lock();
+    it = rcu_item_lookup(id);
+    if (it)
+        pr_info("rcu_example: found id=%d name=%s\n", id, it->name);
+    rcu_read_unlock();
+
+    return it ? count : -ENOENT;
+}
+
 /* Trigger call_rcu manually for testing */
 static ssize_t rcu_call_write(struct file *file, const char __user *buf,
                               size_t count, loff_t *ppos)
@@ -241,72 +501,530 @@ static const struct proc_ops  rcu_add_fops = {
     .proc_write = rcu_add_write,
 };
 
+static const struct proc_ops  rcu_update_fops = {
+    .proc_write = rcu_update_write,
+};
+
 static const struct proc_ops  rcu_del_fops = {
     .proc_write = rcu_del_write,
 };
 
+static const struct proc_ops  rcu_bulk_del_fops = {
+    .proc_write = rcu_bulk_del_write,
+};
+
+static const struct proc_ops  rcu_lookup_fops = {
+    .proc_write = rcu_lookup_write,
+};
+
 static const struct proc_ops  rcu_call_fops = {
     .proc_write = rcu_call_write,
 };
 
+/*
+ * Reader-scaling benchmark
+ *
+ * Each scheme gets its own list of `items` entries with ids 0..items-1.
+ * Readers look up a random id by walking the list; writers bump the value
+ * of a random entry and then sleep write_delay_us, which sets the write
+ * rate. Every scheme runs for duration_ms with the same thread layout:
+ * readers are bound one per online CPU (wrapping around), writers follow.
+ *
+ *  - rcu:      lockless readers; writer copies the entry, list_replace_rcu(),
+ *              synchronize_rcu(), kfree() (write latency includes the grace period)
+ *  - rwlock:   read_lock() / write_lock(), value updated in place
+ *  - spinlock: readers and writers share one spinlock
+ *  - seqlock:  readers retry on a concurrent write, value updated in place
+ */
+#define BENCH_MAX_READERS 256
+#define BENCH_MAX_WRITERS 16
+#define BENCH_MAX_ITEMS 65536
+
+enum { BENCH_RCU, BENCH_RWLOCK, BENCH_SPINLOCK, BENCH_SEQLOCK, BENCH_NR_SCHEMES };
+static const char * const bench_scheme_names[] = { "rcu", "rwlock", "spinlock", "seqlock" };
+
+struct bench_cfg {
+    unsigned int readers;
+    unsigned int writers;
+    unsigned int items;
+    unsigned int duration_ms;
+    unsigned int write_delay_us;
+};
+
+struct bench_item {
+    int id;
+    int val;
+    struct list_head list;
+};
+
+struct bench_ctx {
+    const struct bench_cfg *cfg;
+    int scheme;
+    struct list_head head;
+    spinlock_t lock;        /* RCU writers, and everybody for the spinlock scheme */
+    rwlock_t rwlock;
+    seqlock_t seqlock;
+    bool stop;
+    struct completion done; /* every thread completes once */
+};
+
+struct bench_thread {
+    struct bench_ctx *ctx;
+    u64 ops;
+    u64 ns_total;           /* writers only */
+    u64 ns_max;
+    unsigned long sink;     /* keeps the reader's list walk from being optimized away */
+};
+
+struct bench_result {
+    u64 elapsed_ns;
+    u64 reads;
+    u64 writes;
+    u64 write_ns_total;
+    u64 write_ns_max;
+};
+
+static DEFINE_MUTEX(bench_lock);
+static struct bench_cfg bench_last_cfg;                       /* protected by bench_lock */
+static struct bench_result bench_results[BENCH_NR_SCHEMES];   /* protected by bench_lock */
+
+static struct bench_item *bench_find(struct bench_ctx *ctx, int id)
+{
+    struct bench_item *it;
+
+    list_for_each_entry(it, &ctx->head, list) {
+        if (it->id == id)
+            return it;
+    }
+    return NULL;
+}
+
+static struct bench_item *bench_find_rcu(struct bench_ctx *ctx, int id)
+{
+    struct bench_item *it;
+
+    list_for_each_entry_rcu(it, &ctx->head, list) {
+        if (it->id == id)
+            return it;
+    }
+    return NULL;
+}
+
+static int bench_read(struct bench_ctx *ctx, int id)
+{
+    struct bench_item *it;
+    unsigned int seq;
+    int val;
+
+    switch (ctx->scheme) {
+    case BENCH_RCU:
+        rcu_read_lock();
+        it = bench_find_rcu(ctx, id);
+        val = it ? READ_ONCE(it->val) : 0;
+        rcu_read_unlock();
+        break;
+    case BENCH_RWLOCK:
+        read_lock(&ctx->rwlock);
+        it = bench_find(ctx, id);
+        val = it ? it->val : 0;
+        read_unlock(&ctx->rwlock);
+        break;
+    case BENCH_SPINLOCK:
+        spin_lock(&ctx->lock);
+        it = bench_find(ctx, id);
+        val = it ? it->val : 0;
+        spin_unlock(&ctx->lock);
+        break;
+    default:
+        /* writers never change the list itself, only ->val */
+        do {
+            seq = read_seqbegin(&ctx->seqlock);
+            it = bench_find(ctx, id);
+            val = it ? READ_ONCE(it->val) : 0;
+        } while (read_seqretry(&ctx->seqlock, seq));
+        break;
+    }
+    return val;
+}
+
+static void bench_write(struct bench_ctx *ctx, int id)
+{
+    struct bench_item *it, *new;
+
+    switch (ctx->scheme) {
+    case BENCH_RCU:
+        new = kmalloc(sizeof(*new), GFP_KERNEL);
+        if (!new)
+            return;
+        spin_lock(&ctx->lock);
+        it = bench_find(ctx, id);
+        new->id = it->id;
+        new->val = it->val + 1;
+        list_replace_rcu(&it->list, &new->list);
+        spin_unlock(&ctx->lock);
+        synchronize_rcu();
+        kfree(it);
+        break;
+    case BENCH_RWLOCK:
+        write_lock(&ctx->rwlock);
+        it = bench_find(ctx, id);
+        it->val++;
+        write_unlock(&ctx->rwlock);
+        break;
+    case BENCH_SPINLOCK:
+        spin_lock(&ctx->lock);
+        it = bench_find(ctx, id);
+        it->val++;
+        spin_unlock(&ctx->lock);
+        break;
+    default:
+        write_seqlock(&ctx->seqlock);
+        it = bench_find(ctx, id);
+        WRITE_ONCE(it->val, it->val + 1);
+        write_sequnlock(&ctx->seqlock);
+        break;
+    }
+}
+
+static int bench_reader_fn(void *data)
+{
+    struct bench_thread *t = data;
+    struct bench_ctx *ctx = t->ctx;
+
+    while (!READ_ONCE(ctx->stop)) {
+        t->sink += bench_read(ctx, get_random_u32_below(ctx->cfg->items));
+        if (!(++t->ops & 1023))
+            cond_resched();
+    }
+    complete(&ctx->done);
+    return 0;
+}
+
+static int bench_writer_fn(void *data)
+{
+    struct bench_thread *t = data;
+    struct bench_ctx *ctx = t->ctx;
+    unsigned int delay = ctx->cfg->write_delay_us;
+    u64 start, ns;
+
+    while (!READ_ONCE(ctx->stop)) {
+        start = ktime_get_ns();
+        bench_write(ctx, get_random_u32_below(ctx->cfg->items));
+        ns = ktime_get_ns() - start;
+
+        t->ops++;
+        t->ns_total += ns;
+        t->ns_max = max(t->ns_max, ns);
+        if (delay)
+            usleep_range(delay, delay + delay / 8 + 1);
+        else
+            cond_resched();
+    }
+    complete(&ctx->done);
+    return 0;
+}
+
+static int bench_run_scheme(const struct bench_cfg *cfg, int scheme, struct bench_result *res)
+{
+    unsigned int nr = cfg->readers + cfg->writers, i, started = 0;
+    struct bench_item *it, *tmp;
+    struct task_struct **tasks;
+    struct bench_thread *threads;
+    struct bench_ctx ctx = { .cfg = cfg, .scheme = scheme };
+    u64 start;
+    int ret = -ENOMEM;
+
+    INIT_LIST_HEAD(&ctx.head);
+    spin_lock_init(&ctx.lock);
+    rwlock_init(&ctx.rwlock);
+    seqlock_init(&ctx.seqlock);
+    init_completion(&ctx.done);
+
+    threads = kcalloc(nr, sizeof(*threads), GFP_KERNEL);
+    tasks = kcalloc(nr, sizeof(*tasks), GFP_KERNEL);
+    if (!threads || !tasks)
+        goto out;
+
+    for (i = 0; i < cfg->items; i++) {
+        it = kmalloc(sizeof(*it), GFP_KERNEL);
+        if (!it)
+            goto out;
+        it->id = i;
+        it->val = 0;
+        list_add_tail(&it->list, &ctx.head);
+    }
+
+    for (i = 0; i < nr; i++) {
+        bool reader = i < cfg->readers;
+
+        threads[i].ctx = &ctx;
+        tasks[i] = kthread_create(reader ? bench_reader_fn : bench_writer_fn, &threads[i],
+                                  "rcu_bench_%c%u", reader ? 'r' : 'w', i);
+        if (IS_ERR(tasks[i])) {
+            ret = PTR_ERR(tasks[i]);
+            goto stop;
+        }
+        kthread_bind(tasks[i], cpumask_nth(i % num_online_cpus(), cpu_online_mask));
+        get_task_struct(tasks[i]);
+        started++;
+    }
+
+    start = ktime_get_ns();
+    for (i = 0; i < nr; i++)
+        wake_up_process(tasks[i]);
+    msleep(cfg->duration_ms);
+    WRITE_ONCE(ctx.stop, true);
+    /* each thread completes ctx.done on its way out */
+    for (i = 0; i < nr; i++)
+        wait_for_completion(&ctx.done);
+    res->elapsed_ns = ktime_get_ns() - start;
+
+    for (i = 0; i < nr; i++) {
+        if (i < cfg->readers) {
+            res->reads += threads[i].ops;
+        } else {
+            res->writes += threads[i].ops;
+            res->write_ns_total += threads[i].ns_total;
+            res->write_ns_max = max(res->write_ns_max, threads[i].ns_max);
+        }
+    }
+    ret = 0;
+
+stop:
+    /* threads never woken exit without running their threadfn */
+    for (i = 0; i < started; i++) {
+        kthread_stop(tasks[i]);
+        put_task_struct(tasks[i]);
+    }
+out:
+    /* all threads are gone and RCU writers freed their old copies after a grace period */
+    list_for_each_entry_safe(it, tmp, &ctx.head, list)
+        kfree(it);
+    kfree(tasks);
+    kfree(threads);
+    return ret;
+}
+
+/* parse space separated "name=value" settings; missing ones keep their defaults */
+static int bench_parse(char *buf, struct bench_cfg *cfg)
+{
+    char *tok, *val;
+    unsigned int *field;
+
+    *cfg = (struct bench_cfg) {
+        .readers = num_online_cpus(),
+        .writers = 1,
+        .items = 64,
+        .duration_ms = 1000,
+        .write_delay_us = 1000,
+    };
+
+    while ((tok = strsep(&buf, " \t\n"))) {
+        if (!*tok)
+            continue;
+        val = strchr(tok, '=');
+        if (!val)
+            return -EINVAL;
+        *val++ = '\0';
+
+        if (!strcmp(tok, "readers"))
+            field = &cfg->readers;
+        else if (!strcmp(tok, "writers"))
+            field = &cfg->writers;
+        else if (!strcmp(tok, "items"))
+            field = &cfg->items;
+        else if (!strcmp(tok, "duration_ms"))
+            field = &cfg->duration_ms;
+        else if (!strcmp(tok, "write_delay_us"))
+            field = &cfg->write_delay_us;
+        else
+            return -EINVAL;
+        if (kstrtouint(val, 0, field))
+            return -EINVAL;
+    }
+
+    if (!cfg->readers || cfg->readers > BENCH_MAX_READERS ||
+        cfg->writers > BENCH_MAX_WRITERS ||
+        !cfg->items || cfg->items > BENCH_MAX_ITEMS ||
+        cfg->duration_ms < 10 || cfg->duration_ms > 60000 ||
+        cfg->write_delay_us > USEC_PER_SEC)
+        return -EINVAL;
+    return 0;
+}
+
+static ssize_t rcu_bench_write(struct file *file, const char __user *ubuf,
+                               size_t count, loff_t *ppos)
+{
+    struct bench_cfg cfg;
+    char *buf;
+    int i, ret;
+
+    buf = memdup_user_nul(ubuf, count);
+    if (IS_ERR(buf))
+        return PTR_ERR(buf);
+    ret = bench_parse(buf, &cfg);
+    kfree(buf);
+    if (ret)
+        return ret;
+
+    mutex_lock(&bench_lock);
+    memset(bench_results, 0, sizeof(bench_results));
+    bench_last_cfg = cfg;
+    for (i = 0; i < BENCH_NR_SCHEMES && !ret; i++) {
+        ret = bench_run_scheme(&cfg, i, &bench_results[i]);
+        if (!ret)
+            pr_info("rcu_example: bench %s: %llu reads, %llu writes in %llu ns\n",
+                    bench_scheme_names[i], bench_results[i].reads,
+                    bench_results[i].writes, bench_results[i].elapsed_ns);
+    }
+    mutex_unlock(&bench_lock);
+
+    return ret ? ret : count;
+}
+
+static int rcu_bench_show(struct seq_file *m, void *v)
+{
+    const struct bench_cfg *cfg = &bench_last_cfg;
+    const struct bench_result *res;
+    int i;
+
+    mutex_lock(&bench_lock);
+    if (!bench_results[0].elapsed_ns)
+        goto out;
+
+    seq_printf(m, "readers %u writers %u items %u duration_ms %u write_delay_us %u\n",
+               cfg->readers, cfg->writers, cfg->items, cfg->duration_ms, cfg->write_delay_us);
+    /* reads/s/cpu: each reader is bound to its own CPU while readers <= online CPUs */
+    seq_printf(m, "%-9s %14s %14s %10s %13s %13s\n", "scheme", "reads/s/cpu", "reads/s",
+               "writes/s", "write_avg_ns", "write_max_ns");
+    for (i = 0; i < BENCH_NR_SCHEMES; i++) {
+        res = &bench_results[i];
+        if (!res->elapsed_ns)
+            continue;
+        seq_printf(m, "%-9s %14llu %14llu %10llu %13llu %13llu\n", bench_scheme_names[i],
+                   div_u64(mul_u64_u64_div_u64(res->reads, NSEC_PER_SEC, res->elapsed_ns),
+                           cfg->readers),
+                   mul_u64_u64_div_u64(res->reads, NSEC_PER_SEC, res->elapsed_ns),
+                   mul_u64_u64_div_u64(res->writes, NSEC_PER_SEC, res->elapsed_ns),
+                   res->writes ? div64_u64(res->write_ns_total, res->writes) : 0,
+                   res->write_ns_max);
+    }
+out:
+    mutex_unlock(&bench_lock);
+    return 0;
+}
+
+static int rcu_bench_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rcu_bench_show, NULL);
+}
+
+static const struct file_operations rcu_bench_fops = {
+    .owner   = THIS_MODULE,
+    .open    = rcu_bench_open,
+    .read    = seq_read,
+    .write   = rcu_bench_write,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+static struct dentry *rcu_debugfs;
+
 static struct proc_dir_entry *p_rcu_dir;
 static struct proc_dir_entry *p_rcu_add;
+static struct proc_dir_entry *p_rcu_update;
 static struct proc_dir_entry *p_rcu_del;
+static struct proc_dir_entry *p_rcu_bulk_del;
 static struct proc_dir_entry *p_rcu_show;
+static struct proc_dir_entry *p_rcu_lookup;
 static struct proc_dir_entry *p_rcu_call;
 
 static int __init rcu_example_init(void)
 {
+    int ret;
+
     pr_info("rcu_example: init\n");
 
+    rcu_item_cache = KMEM_CACHE(rcu_item, 0);
+    if (!rcu_item_cache)
+        return -ENOMEM;
+
+    ret = rhashtable_init(&rcu_items, &rcu_item_params);
+    if (ret) {
+        kmem_cache_destroy(rcu_item_cache);
+        return ret;
+    }
+
     p_rcu_dir = proc_mkdir("rcu_example", NULL);
     if (!p_rcu_dir)
         goto err;
 
     p_rcu_add = proc_create("rcu_add", 0222, p_rcu_dir, &rcu_add_fops);
+    p_rcu_update = proc_create("rcu_update", 0222, p_rcu_dir, &rcu_update_fops);
     p_rcu_del = proc_create("rcu_del", 0222, p_rcu_dir, &rcu_del_fops);
+    p_rcu_bulk_del = proc_create("rcu_bulk_del", 0222, p_rcu_dir, &rcu_bulk_del_fops);
     p_rcu_show = proc_create("rcu_show", 0444, p_rcu_dir, &rcu_proc_fops);
+    p_rcu_lookup = proc_create("rcu_lookup", 0222, p_rcu_dir, &rcu_lookup_fops);
     p_rcu_call = proc_create("rcu_call", 0222, p_rcu_dir, &rcu_call_fops);
 
-    if (!p_rcu_add || !p_rcu_del || !p_rcu_show || !p_rcu_call)
+    if (!p_rcu_add || !p_rcu_update || !p_rcu_del || !p_rcu_bulk_del ||
+        !p_rcu_show || !p_rcu_lookup || !p_rcu_call)
         goto cleanup_proc;
 
+    /* debugfs only hosts the benchmark; failing to create it is not fatal */
+    rcu_debugfs = debugfs_create_dir("rcu_example", NULL);
+    debugfs_create_file("bench", 0600, rcu_debugfs, NULL, &rcu_bench_fops);
+
     return 0;
 
 cleanup_proc:
     if (p_rcu_add) proc_remove(p_rcu_add);
+    if (p_rcu_update) proc_remove(p_rcu_update);
     if (p_rcu_del) proc_remove(p_rcu_del);
+    if (p_rcu_bulk_del) proc_remove(p_rcu_bulk_del);
     if (p_rcu_show) proc_remove(p_rcu_show);
+    if (p_rcu_lookup) proc_remove(p_rcu_lookup);
     if (p_rcu_call) proc_remove(p_rcu_call);
     if (p_rcu_dir) proc_remove(p_rcu_dir);
 err:
+    rhashtable_destroy(&rcu_items);
+    kmem_cache_destroy(rcu_item_cache);
     pr_err("rcu_example: failed to create proc entries\n");
     return -ENOMEM;
 }
 
-static void rcu_list_cleanup(void)
+static void rcu_item_free_entry(void *ptr, void *arg)
 {
-    struct rcu_item *it, *tmp;
+    kmem_cache_free(rcu_item_cache, ptr);
+}
 
-    /* remove all entries and free them via call_rcu */
-    spin_lock(&rcu_list_lock);
-    list_for_each_entry_safe(it, tmp, &rcu_list_head, list) {
-        list_del_rcu(&it->list);
-        call_rcu(&it->rcu, rcu_item_free_callback);
-    }
-    spin_unlock(&rcu_list_lock);
+static void rcu_list_cleanup(void)
+{
+    /* the proc files are gone, so nobody can still be reading the table */
+    rhashtable_free_and_destroy(&rcu_items, rcu_item_free_entry, NULL);
 
-    /* wait for all RCU callbacks to complete before unloading */
-    synchronize_rcu();
+    /*
+     * wait for all call_rcu() callbacks and pending kfree_rcu() objects
+     * before the cache goes away; synchronize_rcu() only waits for a
+     * grace period, not for the callbacks
+     */
+    rcu_barrier();
+    kvfree_rcu_barrier();
+    kmem_cache_destroy(rcu_item_cache);
 }
 
 static void __exit rcu_example_exit(void)
 {
     pr_info("rcu_example: exit\n");
 
+    debugfs_remove_recursive(rcu_debugfs);
+
     if (p_rcu_add) proc_remove(p_rcu_add);
+    if (p_rcu_update) proc_remove(p_rcu_update);
     if (p_rcu_del) proc_remove(p_rcu_del);
+    if (p_rcu_bulk_del) proc_remove(p_rcu_bulk_del);
     if (p_rcu_show) proc_remove(p_rcu_show);
+    if (p_rcu_lookup) proc_remove(p_rcu_lookup);
     if (p_rcu_call) proc_remove(p_rcu_call);
     if (p_rcu_dir) proc_remove(p_rcu_dir);
 